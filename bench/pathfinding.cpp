@@ -0,0 +1,139 @@
+// Generates roomAccretion floors the way a new game does and reports, per
+// floor, how many tiles the searches over it take off their queues: a full
+// Dijkstra scan from the player against one that stops at a target, with the
+// binary heap and the bucket queue, A* to the same targets, and repairing the
+// incremental field after a door opens against building it again.
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include <flecs.h>
+
+#include "actor.hpp"
+#include "engine.hpp"
+#include "game_map.hpp"
+#include "module.hpp"
+#include "pathfinding.hpp"
+#include "room_accretion.hpp"
+#include "scent.hpp"
+
+namespace {
+
+template <typename F> double microseconds(F f, int reps) {
+  auto start = std::chrono::steady_clock::now();
+  for (auto i = 0; i < reps; i++) {
+    f();
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<double, std::micro>(elapsed).count() / reps;
+}
+
+} // namespace
+
+int main() {
+  const auto queries = 20;
+  for (auto seed = 1u; seed <= 5; seed++) {
+    auto ecs = flecs::world();
+    ecs.import <module>();
+    ecs.entity("seed").set<Seed>({seed});
+    ecs.entity("turn").set<Turn>({0});
+    auto player = ecs.entity("player")
+                      .set<Position>({0, 0})
+                      .set<Scent>({ScentType::player, 0});
+    auto map = ecs.entity();
+    auto cfg = roomAccretion::Config{};
+    cfg.lit = false;
+    cfg.ROOM_MIN_SIZE = 3;
+    cfg.MAX_ROOMS = 300;
+    cfg.MAX_ITER = 1000;
+    cfg.LAKE_ITER = 0;
+    map.emplace<GameMap>(
+        roomAccretion::generateDungeon(cfg, map, 80, 43, 1, player));
+    auto &gameMap = map.get_mut<GameMap>();
+
+    auto dimensions =
+        pathfinding::Index{gameMap.getWidth(), gameMap.getHeight()};
+    auto floor = std::vector<pathfinding::Index>();
+    auto doors = std::vector<pathfinding::Index>();
+    for (auto y = 0; y < dimensions[1]; y++) {
+      for (auto x = 0; x < dimensions[0]; x++) {
+        if (gameMap.isWalkable(x, y)) {
+          floor.push_back({x, y});
+        } else if (gameMap.entityAt<Openable>({x, y})) {
+          doors.push_back({x, y});
+        }
+      }
+    }
+    pathfinding::Index origin = player.get<Position>();
+    auto start = [&](auto xy) { return origin == xy; };
+    auto adjacent = [&](auto &xy) { return gameMap.movesFrom(xy, false); };
+    auto cost = [&](auto xy) { return gameMap.moveCost(xy); };
+
+    auto rng = std::mt19937(seed);
+    auto full = size_t{0};
+    auto stopped = size_t{0};
+    auto fullBucket = size_t{0};
+    auto stoppedBucket = size_t{0};
+    auto astar = size_t{0};
+    for (auto i = 0; i < queries; i++) {
+      auto target = floor[rng() % floor.size()];
+      auto heap = pathfinding::Dijkstra(dimensions, start, adjacent, cost);
+      heap.scan();
+      full += heap.expanded;
+      auto heapStop = pathfinding::Dijkstra(dimensions, start, adjacent, cost);
+      heapStop.scan({target});
+      stopped += heapStop.expanded;
+      auto bucket = pathfinding::Dijkstra(dimensions, start, adjacent, cost,
+                                          pathfinding::BucketQueue<2>());
+      bucket.scan();
+      fullBucket += bucket.expanded;
+      auto bucketStop = pathfinding::Dijkstra(
+          dimensions, start, adjacent, cost, pathfinding::BucketQueue<2>());
+      bucketStop.scan({target});
+      stoppedBucket += bucketStop.expanded;
+      auto search = pathfinding::AStar(dimensions, start, adjacent, cost,
+                                       gameMap.portals());
+      search.scan(origin, target);
+      astar += search.expanded;
+    }
+    std::printf("seed %u: %zu floor tiles, %zu doors\n", seed, floor.size(),
+                doors.size());
+    std::printf("  mean expanded per query: heap full %zu, heap stop %zu, "
+                "bucket full %zu, bucket stop %zu, A* %zu\n",
+                full / queries, stopped / queries, fullBucket / queries,
+                stoppedBucket / queries, astar / queries);
+
+    auto heapTime = microseconds(
+        [&]() {
+          auto d = pathfinding::Dijkstra(dimensions, start, adjacent, cost);
+          d.scan();
+        },
+        300);
+    auto bucketTime = microseconds(
+        [&]() {
+          auto d = pathfinding::Dijkstra(dimensions, start, adjacent, cost,
+                                         pathfinding::BucketQueue<2>());
+          d.scan();
+        },
+        300);
+    std::printf("  full scan: heap %.1f us, bucket %.1f us\n", heapTime,
+                bucketTime);
+
+    // Open the doors one at a time, repairing the field after each.
+    auto field = pathfinding::IncrementalDijkstra<pathfinding::BucketQueue<2>>(
+        dimensions);
+    field.scan(start, adjacent, cost);
+    auto rebuilt = field.expanded;
+    field.expanded = 0;
+    for (auto &door : doors) {
+      gameMap.setProperties(door[0], door[1], true, true);
+      field.update(&door, &door + 1, start, adjacent, cost);
+    }
+    if (!doors.empty()) {
+      std::printf("  incremental field: scan %zu, mean per door opened %zu\n",
+                  rebuilt, field.expanded / doors.size());
+    }
+  }
+}
@@ -0,0 +1,117 @@
+// Turns per second of scent diffusion on a 256x256 floor with a player's
+// trail and 32 corpses putting scent down every turn: the float grid worked
+// out a tile at a time and copied back, as it was before ScentField, then
+// ScentField alone and over the shared pool, as update_scent runs it.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "bitplane.hpp"
+#include "defines.hpp"
+#include "scent.hpp"
+#include "scent_field.hpp"
+#include "thread_pool.hpp"
+
+namespace {
+
+const int width = 256;
+const int height = 256;
+const int turns = 2000;
+
+template <typename F> double turnsPerSecond(F turn) {
+  auto start = std::chrono::steady_clock::now();
+  for (auto i = 0; i < turns; i++) {
+    turn(i);
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return turns / std::chrono::duration<double>(elapsed).count();
+}
+
+inline size_t offset(std::array<int, 2> xy) {
+  return (size_t)(xy[1] * width + xy[0]);
+}
+
+// The player walks back and forth along a corridor.
+inline std::array<int, 2> trail(int turn) { return {20 + turn % 200, 128}; }
+
+} // namespace
+
+int main() {
+  auto rng = std::mt19937(3);
+  auto transparent = BitPlane(width, height);
+  for (auto y = 0; y < height; y++) {
+    for (auto x = 0; x < width; x++) {
+      transparent.set(x, y, rng() % 100 < 80);
+    }
+  }
+  auto corpses = std::vector<std::array<int, 2>>();
+  for (auto i = 0; i < 32; i++) {
+    corpses.push_back(
+        {(int)(rng() % (unsigned)width), (int)(rng() % (unsigned)height)});
+  }
+  const auto types = (size_t)ScentType::MAX;
+
+  auto scent = std::vector<Scent>((size_t)(width * height));
+  auto floatGrid = turnsPerSecond([&](int turn) {
+    for (auto &c : corpses) {
+      scent[offset(c)] += Scent{ScentType::decay, 1000};
+    }
+    scent[offset(trail(turn))] += Scent{ScentType::player, 100};
+    auto next = std::vector<Scent>((size_t)(width * height));
+    for (auto y = 0; y < height; y++) {
+      for (auto x = 0; x < width; x++) {
+        if (!transparent.test(x, y)) {
+          continue;
+        }
+        auto power = std::array<float, types>{};
+        auto count = std::array<int, types>{};
+        auto add = [&](const Scent &s) {
+          power[(size_t)s.type] += s.power;
+          count[(size_t)s.type]++;
+        };
+        add(scent[offset({x, y})]);
+        for (auto &dir : directions) {
+          auto x2 = x + dir[0];
+          auto y2 = y + dir[1];
+          if (transparent.test(x2, y2)) {
+            add(scent[offset({x2, y2})]);
+          }
+        }
+        auto i = (size_t)(std::max_element(power.begin(), power.end()) -
+                          power.begin());
+        auto &n = next[offset({x, y})];
+        n = {(ScentType)i, 0.9f * (power[i] / (float)count[i])};
+        if (n.type == ScentType::none || n.power < 1.0f) {
+          n = {};
+        }
+      }
+    }
+    scent = next;
+  });
+  std::printf("float grid: %.0f turns/s\n", floatGrid);
+
+  const auto decay = ScentField::Decay{9, 10, TileScent::one};
+  for (auto pool : {(ThreadPool *)nullptr, &ThreadPool::shared()}) {
+    auto front = std::vector<TileScent>((size_t)(width * height));
+    auto back = std::vector<TileScent>((size_t)(width * height));
+    auto field = ScentField(width, height);
+    auto deposit = [&](std::array<int, 2> xy, const Scent &s) {
+      front[offset(xy)] += s;
+      field.touch(offset(xy));
+    };
+    auto diffused = turnsPerSecond([&](int turn) {
+      for (auto &c : corpses) {
+        deposit(c, Scent{ScentType::decay, 1000});
+      }
+      deposit(trail(turn), Scent{ScentType::player, 100});
+      field.diffuse(front, transparent, back, decay, pool, 16);
+      front.swap(back);
+    });
+    std::printf("ScentField%s: %.0f turns/s\n", pool ? " on the pool" : "",
+                diffused);
+  }
+}
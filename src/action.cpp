@@ -72,39 +72,35 @@ static flecs::entity itemAtLocation(flecs::entity e) {
   auto currentMap = e.world().lookup("currentMap");
   assert(currentMap);
   auto map = currentMap.target<CurrentMap>();
-  auto q = e.world()
-               .query_builder<const Position>("module::pickup")
-               .with<Item>()
-               .with(flecs::ChildOf, map)
-               .build();
-  return q.find(
-      [&](flecs::entity item, auto &p) { return e != item && p == pos; });
+  auto item = map.get<GameMap>().entityAt<Item>(pos);
+  return item != e ? item : e.null();
 }
 
 ActionResult MoveAction::perform(flecs::entity e) const {
   auto &pos = e.get_mut<Position>();
   auto mapEntity = e.world().lookup("currentMap").target<CurrentMap>();
-  auto &map = mapEntity.get<GameMap>();
+  auto &map = mapEntity.get_mut<GameMap>();
   if (map.inBounds(pos + dxy)) {
     if (map.isWalkable(pos + dxy) ||
         (e.has<Flying>() && map.isFlyable(pos + dxy))) {
       if (GameMap::get_blocking_entity(mapEntity, pos + dxy) == e.null()) {
-        auto portal =
-            e.world()
-                .query_builder<const Position>()
-                .with(flecs::ChildOf, mapEntity)
-                .with(e.world().component<Portal>(), flecs::Wildcard)
-                .build()
-                .find([&](const Position &p) { return p == pos + dxy; });
-        if (portal) {
-          pos = portal.target<Portal>().get<Position>();
+        auto exit = map.portalExit(pos + dxy);
+        if (exit) {
+          // Through the portal counts as a move even when the step out of the
+          // exit is blocked, so the index has to follow right away.
+          pos = *exit;
+          map.moveIndexed(e, pos);
           auto ret = perform(e);
           assert(ret.type == ActionResultType::Success ||
                  ret.type == ActionResultType::Failure);
+          assert(!map.indexedAt(e) || pos == *map.indexedAt(e));
           ret.type = ActionResultType::Success;
           return ret;
         }
         pos.move(dxy);
+        // Position is edited in place, possibly while deferred, so keep the
+        // index in step here rather than waiting on the observers.
+        map.moveIndexed(e, pos);
         auto inventory = e.try_get<Inventory>();
         if (!inventory) {
           return {ActionResultType::Success, "", 1.0f};
@@ -147,12 +143,7 @@ ActionResult DoorDirectionAction::perform(flecs::entity e) const {
   assert(currentMap);
   auto mapEntity = currentMap.target<CurrentMap>();
 
-  auto q = ecs.query_builder<const Position>("module::blocksPosition")
-               .with(flecs::ChildOf, mapEntity)
-               .with<Openable>()
-               .build();
-
-  auto target = q.find([=](const Position &p) { return p == pos + dxy; });
+  auto target = mapEntity.get<GameMap>().entityAt<Openable>(pos + dxy);
   if (target) {
     toggleDoor(target);
     return {ActionResultType::Success, "", 0.0f};
@@ -167,20 +158,20 @@ ActionResult DoorAction::perform(flecs::entity e) const {
   auto currentMap = ecs.lookup("currentMap");
   assert(currentMap);
   auto mapEntity = currentMap.target<CurrentMap>();
-
-  auto q = ecs.query_builder<const Position>("module::blocksPosition")
-               .with(flecs::ChildOf, mapEntity)
-               .with<Openable>()
-               .build();
+  auto &map = mapEntity.get<GameMap>();
 
   auto success = false;
   ecs.defer_begin();
-  q.each([&](auto e, auto &p) {
-    if (pos.distanceSquared(p) <= 2) {
-      toggleDoor(e);
-      success = true;
+  for (auto y = pos.y - 1; y <= pos.y + 1; y++) {
+    for (auto x = pos.x - 1; x <= pos.x + 1; x++) {
+      for (auto &door : map.entitiesAt({x, y})) {
+        if (door.has<Openable>()) {
+          toggleDoor(door);
+          success = true;
+        }
+      }
     }
-  });
+  }
   ecs.defer_end();
   if (success) {
     return {ActionResultType::Success, "", 0.0f};
@@ -8,7 +8,7 @@
 #include "action.hpp"
 #include "actor.hpp"
 #include "defines.hpp"
-#include "fov.hpp"
+#include "engine.hpp"
 #include "game_map.hpp"
 #include "pathfinding.hpp"
 
@@ -29,44 +29,7 @@ std::unique_ptr<Action> HostileAi::act(flecs::entity self) {
       return std::make_unique<MeleeAction>(dx, dy);
     }
 
-    auto dij = pathfinding::Dijkstra(
-        {map.getWidth(), map.getHeight()},
-        [=](auto xy) { return target == xy; },
-        [&](auto &xy) {
-          auto ret = std::vector<pathfinding::Index>();
-          ret.reserve(9); // 8 directions plus a portal
-          for (auto &dir : directions) {
-            auto next = pathfinding::Index{xy[0] + dir[0], xy[1] + dir[1]};
-            if (map.inBounds(next) &&
-                (map.isWalkable(next) ||
-                 (self.has<Flying>() && map.isFlyable(next)))) {
-              ret.push_back(next);
-            }
-          }
-          flecs::entity e = ecs.query_builder<Position>()
-                                .with(ecs.component<Portal>(), flecs::Wildcard)
-                                .with(flecs::ChildOf, mapEntity)
-                                .build()
-                                .find([xy](auto &p) { return p == xy; });
-          if (e) {
-            ret.push_back(e.target<Portal>().get<Position>());
-          }
-          return ret;
-        },
-        [&](auto xy) {
-          if (ecs.query_builder<const Position>()
-                  .with<Openable>()
-                  .with(flecs::ChildOf, mapEntity)
-                  .build()
-                  .find([xy](auto &p) { return p == xy; })) {
-            if (!map.isWalkable(xy)) {
-              return 2;
-            }
-          }
-          return 1;
-        });
-    dij.scan();
-    path = pathfinding::constructPath(target, pos, dij.cameFrom);
+    path = map.chasePlayer(pos, target, self.has<Flying>());
     assert(pos == path[0]);
     std::reverse(path.begin(), path.end());
     path.pop_back();
@@ -112,59 +75,15 @@ std::unique_ptr<Action> FleeAi::act(flecs::entity self) {
   auto player = ecs.lookup("player");
   auto &playerPos = player.get<Position>();
   auto mapEntity = ecs.lookup("currentMap").target<CurrentMap>();
-  const auto &map = mapEntity.get<GameMap>();
+  auto &map = mapEntity.get_mut<GameMap>();
 
   // TODO handle invisibility
-  auto dij = pathfinding::Dijkstra(
-      {map.getWidth(), map.getHeight()},
-      [=](auto xy) { return playerPos == xy; },
-      [&](auto &xy) {
-        auto ret = std::vector<pathfinding::Index>();
-        ret.reserve(9); // 8 directions plus a portal
-        for (auto &dir : directions) {
-          auto next = pathfinding::Index{xy[0] + dir[0], xy[1] + dir[1]};
-          if (map.inBounds(next) &&
-              (map.isWalkable(next) ||
-               (self.has<Flying>() && map.isFlyable(next)))) {
-            ret.push_back(next);
-          } else if (ecs.query_builder<const Position>()
-                         .with<Openable>()
-                         .with(flecs::ChildOf, mapEntity)
-                         .build()
-                         .find([next](auto &p) { return p == next; })) {
-            ret.push_back(next);
-          }
-        }
-        flecs::entity e = ecs.query_builder<Position>()
-                              .with(ecs.component<Portal>(), flecs::Wildcard)
-                              .with(flecs::ChildOf, mapEntity)
-                              .build()
-                              .find([xy](auto &p) { return p == xy; });
-        if (e) {
-          ret.push_back(e.target<Portal>().get<Position>());
-        }
-        return ret;
-      },
-      [&](auto xy) {
-        if (ecs.query_builder<const Position>()
-                .with<Openable>()
-                .with(flecs::ChildOf, mapEntity)
-                .build()
-                .find([xy](auto &p) { return p == xy; })) {
-          if (!map.isWalkable(xy)) {
-            return 2;
-          }
-        }
-        return 1;
-      });
-  dij.scan();
-  dij *= -1.2f;
-  dij.rescan();
   auto pos = self.get<Position>();
-  auto xy = dij.cameFrom[pos];
-  assert(xy[0] >= 0);
-  assert(xy[1] >= 0);
-  return std::make_unique<MoveAction>(xy[0] - pos.x, xy[1] - pos.y);
+  auto xy = map.fleeStep(pos, playerPos, self.has<Flying>());
+  if (!xy) {
+    return nullptr;
+  }
+  return std::make_unique<MoveAction>((*xy)[0] - pos.x, (*xy)[1] - pos.y);
 }
 
 WanderAi::WanderAi(const GameMap &map)
@@ -172,125 +91,68 @@ WanderAi::WanderAi(const GameMap &map)
   for (auto y = 0; y < map.getHeight(); y++) {
     for (auto x = 0; x < map.getWidth(); x++) {
       if (map.isWalkable({x, y})) {
-        memory[y * map.getWidth() + x] = 0;
+        memory[y * map.getWidth() + x] = neverSeen;
       }
     }
   }
 }
 
-struct FovMap {
-  FovMap(const GameMap &m)
-      : width(m.getWidth()), height(m.getHeight()),
-        tiles(std::make_unique<uint8_t[]>(width * height)) {
-    for (auto y = 0; y < height; y++) {
-      for (auto x = 0; x < width; x++) {
-        auto &t = tiles[y * width + x];
-        t = (m.isWalkable(x, y) ? WALKABLE : 0) |
-            (m.isTransparent(x, y) ? TRANSPARENT : 0) |
-            (m.isVisible(x, y) ? INFOV : 0);
-      }
-    }
-  }
-
-  inline int getWidth() const { return width; };
-  inline int getHeight() const { return height; };
-  inline bool inBounds(std::array<int, 2> xy) const {
-    return 0 <= xy[0] && xy[0] < getWidth() && 0 <= xy[1] &&
-           xy[1] < getHeight();
-  }
-  inline bool isWalkable(std::array<int, 2> xy) const {
-    return inBounds(xy) && (tiles[xy[1] * getWidth() + xy[0]] & WALKABLE);
-  }
-  inline bool isTransparent(std::array<int, 2> xy) const {
-    return inBounds(xy) && (tiles[xy[1] * getWidth() + xy[0]] & TRANSPARENT);
-  }
-  inline bool isFlyable(std::array<int, 2> xy) const {
-    return isTransparent(xy) && !isWalkable(xy);
-  };
-  inline void setFov(std::array<int, 2> xy, bool seen) {
-    assert(inBounds(xy));
-    auto &t = tiles[xy[1] * getWidth() + xy[0]];
-    if (seen) {
-      t |= INFOV;
-    } else {
-      t &= ~INFOV;
-    }
-  }
-  inline bool isVisible(std::array<int, 2> xy) const {
-    return inBounds(xy) && (tiles[xy[1] * getWidth() + xy[0]] & INFOV);
-  }
-
-  int width;
-  int height;
-  std::unique_ptr<uint8_t[]> tiles;
-  static constexpr auto WALKABLE = (uint8_t)1;
-  static constexpr auto TRANSPARENT = (uint8_t)2;
-  static constexpr auto INFOV = (uint8_t)4;
-};
-
 std::unique_ptr<Action> WanderAi::act(flecs::entity self) {
-  for (auto &m : memory) {
-    if (m != pathfinding::Infinity)
-      m--;
-  }
   auto ecs = self.world();
+  auto now = (int)ecs.lookup("turn").get<Turn>().turn;
   auto mapEntity = ecs.lookup("currentMap").target<CurrentMap>();
-  auto map = FovMap(mapEntity.get<GameMap>());
-  computeFov(mapEntity, map, self.get<Position>(), 8);
-  for (auto y = 0; y < map.getHeight(); y++) {
-    for (auto x = 0; x < map.getWidth(); x++) {
-      if (map.isVisible({x, y})) {
-        memory[y * map.getWidth() + x] = 0;
+  auto &gameMap = mapEntity.get_mut<GameMap>();
+
+  // The tiles seen last time become sources, the ones seen now stop being
+  // sources. Nothing else changes its value, since everything else ages at
+  // the same rate.
+  auto changed = std::move(seen);
+  seen.clear();
+  gameMap.sightOf(self, self.get<Position>(), viewRadius())
+      .forEach([this](auto xy) { seen.push_back(xy); });
+  for (auto &xy : seen) {
+    memory[(size_t)(xy[1] * gameMap.getWidth() + xy[0])] = now;
+  }
+
+  auto source = [&](const pathfinding::Index &xy) {
+    auto t = memory[(size_t)(xy[1] * gameMap.getWidth() + xy[0])];
+    return t == now ? pathfinding::Infinity : t;
+  };
+  auto flying = self.has<Flying>();
+  auto adjacent = [&](auto &xy) { return gameMap.movesFrom(xy, flying, true); };
+  auto cost = [&](auto xy) { return gameMap.moveCost(xy); };
+
+  auto changes = gameMap.changesSince(cursor);
+  if (!field || field->getDimensions() !=
+                    pathfinding::Index{gameMap.getWidth(),
+                                       gameMap.getHeight()} ||
+      !changes) {
+    field.emplace(pathfinding::Index{gameMap.getWidth(), gameMap.getHeight()},
+                  pathfinding::BucketQueue<2>());
+    field->scan(source, adjacent, cost);
+#ifndef NDEBUG
+    // Every walkable tile out of sight has to pull, or the parts of the map
+    // never seen would stay out of the field for good.
+    for (auto y = 0; y < gameMap.getHeight(); y++) {
+      for (auto x = 0; x < gameMap.getWidth(); x++) {
+        auto xy = pathfinding::Index{x, y};
+        assert(!gameMap.isWalkable(xy) ||
+               std::find(seen.begin(), seen.end(), xy) != seen.end() ||
+               source(xy) != pathfinding::Infinity);
       }
     }
+#endif
+  } else {
+    changed.insert(changed.end(), seen.begin(), seen.end());
+    changed.insert(changed.end(), changes->first, changes->second);
+    field->update(changed.begin(), changed.end(), source, adjacent, cost);
   }
-
-  auto dij = pathfinding::WanderDijkstra(
-      {map.getWidth(), map.getHeight()}, memory,
-      [&](auto &xy) {
-        auto ret = std::vector<pathfinding::Index>();
-        ret.reserve(9); // 8 directions plus a portal
-        for (auto &dir : directions) {
-          auto next = pathfinding::Index{xy[0] + dir[0], xy[1] + dir[1]};
-          if (map.inBounds(next) &&
-              (map.isWalkable(next) ||
-               (self.has<Flying>() && map.isFlyable(next)))) {
-            ret.push_back(next);
-          } else if (ecs.query_builder<const Position>()
-                         .with<Openable>()
-                         .with(flecs::ChildOf, mapEntity)
-                         .build()
-                         .find([next](auto &p) { return p == next; })) {
-            ret.push_back(next);
-          }
-        }
-        flecs::entity e = ecs.query_builder<Position>()
-                              .with(ecs.component<Portal>(), flecs::Wildcard)
-                              .with(flecs::ChildOf, mapEntity)
-                              .build()
-                              .find([xy](auto &p) { return p == xy; });
-        if (e) {
-          ret.push_back(e.target<Portal>().get<Position>());
-        }
-        return ret;
-      },
-      [&](auto xy) {
-        if (ecs.query_builder<const Position>()
-                .with<Openable>()
-                .with(flecs::ChildOf, mapEntity)
-                .build()
-                .find([xy](auto &p) { return p == xy; })) {
-          if (!map.isWalkable(xy)) {
-            return 2;
-          }
-        }
-        return 1;
-      });
-  dij.scan();
+  cursor = gameMap.changeCount();
 
   auto pos = self.get<Position>();
-  auto xy = dij.cameFrom[pos];
-  assert(xy[0] >= 0);
-  assert(xy[1] >= 0);
+  auto xy = field->cameFrom[pos];
+  if (xy[0] < 0) {
+    return nullptr;
+  }
   return std::make_unique<MoveAction>(xy[0] - pos.x, xy[1] - pos.y);
 }
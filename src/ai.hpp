@@ -2,16 +2,21 @@
 
 #include <array>
 #include <memory>
+#include <optional>
 #include <vector>
 
 #include <flecs.h>
 
 #include "action.hpp"
 #include "game_map.hpp"
+#include "pathfinding.hpp"
 
 struct Ai {
   virtual std::unique_ptr<Action> act(flecs::entity self) = 0;
   virtual ~Ai() = default;
+  // How far this AI looks around for itself, to have its sight cast with the
+  // rest at the start of the monsters' turns. 0 if it doesn't.
+  virtual int viewRadius() const { return 0; }
 
   int unused; // We need this struct to have size > 0 in order to store it
               // in flecs::world.
@@ -43,6 +48,18 @@ struct WanderAi : Ai {
   WanderAi(const GameMap &map);
   virtual std::unique_ptr<Action> act(flecs::entity self);
   virtual ~WanderAi() = default;
+  virtual int viewRadius() const override { return 8; }
 
+  // The turn each tile was last seen, neverSeen for floor not seen yet, or
+  // Infinity for walls never seen.
   std::vector<int> memory;
+  // Before any turn, so it is older than everything seen and never now.
+  static constexpr auto neverSeen = -1;
+
+private:
+  // Downhill leads to the tiles seen longest ago. Rebuilt after loading.
+  std::optional<pathfinding::IncrementalDijkstra<pathfinding::BucketQueue<2>>>
+      field;
+  std::vector<pathfinding::Index> seen;
+  size_t cursor = 0;
 };
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// One bit per tile, 64 tiles to a word. Each row starts on a fresh word, so a
+// kernel can take a row, or any 64 tiles of it, in one go.
+class BitPlane {
+public:
+  BitPlane(int width = 0, int height = 0)
+      : width(width), height(height), stride((size_t)((width + 63) / 64)),
+        words(stride * (size_t)height, 0) {};
+
+  inline bool test(int x, int y) const {
+    if (!inBounds(x, y)) {
+      return false;
+    }
+    return (row(y)[x / 64] >> (x % 64)) & 1;
+  }
+  inline void set(int x, int y, bool value) {
+    auto &w = words[(size_t)y * stride + (size_t)(x / 64)];
+    auto bit = uint64_t(1) << (x % 64);
+    w = value ? (w | bit) : (w & ~bit);
+  }
+  inline void clear() { std::fill(words.begin(), words.end(), 0); }
+
+  inline size_t wordsPerRow() const { return stride; }
+  inline const uint64_t *row(int y) const {
+    return words.data() + (size_t)y * stride;
+  }
+  // Tiles x to x + 63 of row y, tile x in the lowest bit. Anything off the
+  // map reads as 0, so x can be negative or run past the end.
+  inline uint64_t bits(int x, int y) const {
+    if (y < 0 || y >= height || x <= -64 || x >= width) {
+      return 0;
+    }
+    if (x < 0) {
+      return row(y)[0] << -x;
+    }
+    auto r = row(y);
+    auto w = (size_t)(x / 64);
+    auto shift = x % 64;
+    auto ret = r[w] >> shift;
+    if (shift != 0 && w + 1 < stride) {
+      ret |= r[w + 1] << (64 - shift);
+    }
+    return ret;
+  }
+  // Which of the 64 tiles starting at x are on the map.
+  inline uint64_t mask(int x) const {
+    auto n = width - x;
+    return n >= 64 ? ~uint64_t(0) : (uint64_t(1) << n) - 1;
+  }
+
+  inline int getWidth() const { return width; }
+  inline int getHeight() const { return height; }
+
+private:
+  inline bool inBounds(int x, int y) const {
+    return 0 <= x && x < width && 0 <= y && y < height;
+  }
+
+  int width;
+  int height;
+  size_t stride;
+  std::vector<uint64_t> words;
+};
@@ -35,6 +35,9 @@ inline std::string directionName(const std::array<int, 2> &dir) {
 
 const std::filesystem::path data_dir = "save";
 constexpr auto saveFilename = "savegame.sav";
+// Bumped whenever a save from before can no longer be read back. 2: the map's
+// scent became TileScent.
+constexpr auto saveVersion = 2;
 constexpr auto configName = "config.dat";
 
 constexpr auto DECORATION = std::array<int, 9>{
@@ -2,12 +2,17 @@
 
 #include <libtcod.hpp>
 
+#include <cctype>
+#include <cstdlib>
 #include <filesystem>
 #include <fstream>
+#include <optional>
 #include <sstream>
+#include <string>
 
 #include "actor.hpp"
 #include "ai.hpp"
+#include "defines.hpp"
 #include "game_map.hpp"
 #include "input_handler.hpp"
 #include "inventory.hpp"
@@ -23,6 +28,21 @@ void Engine::handle_enemy_turns(flecs::world ecs) {
                .with(flecs::ChildOf, map)
                .build();
 
+  auto viewers = std::vector<std::pair<flecs::entity, Viewer>>();
+  q.run([&viewers](flecs::iter &it) {
+    while (it.next()) {
+      for (auto i : it) {
+        auto e = it.entity(i);
+        auto ai_type = static_cast<Ai *>(e.try_get_mut(it.id(0)));
+        auto radius = ai_type->viewRadius();
+        if (radius > 0 && !e.has<Frozen>()) {
+          viewers.push_back({e, {e.get<Position>(), radius}});
+        }
+      }
+    }
+  });
+  map.get_mut<GameMap>().perceive(viewers);
+
   ecs.defer_begin();
   q.run([](flecs::iter &it) {
     while (it.next()) {
@@ -51,10 +71,47 @@ void Engine::handle_enemy_turns(flecs::world ecs) {
 }
 
 void Engine::save_as(flecs::world ecs, const std::filesystem::path &file_name) {
+  ecs.entity("saveVersion").set<SaveVersion>({saveVersion});
   auto output = std::ofstream(file_name);
   output << ecs.to_json();
 }
 
+// The version a save was written with, read off its JSON text so that a save
+// from another version can be turned away before any of it is deserialized.
+// Saves from before versioning have none. It looks for the SaveVersion
+// component, as `SaveVersion": {"version": n}`, so an entity named after the
+// component doesn't count.
+static std::optional<long> savedVersion(const std::string &json) {
+  auto at = size_t{0};
+  auto skip = [&]() {
+    while (at < json.size() && std::isspace((unsigned char)json[at])) {
+      at++;
+    }
+  };
+  auto expect = [&](const std::string &token) {
+    skip();
+    if (json.compare(at, token.size(), token) != 0) {
+      return false;
+    }
+    at += token.size();
+    return true;
+  };
+  const auto key = std::string("SaveVersion\"");
+  for (auto found = json.find(key); found != std::string::npos;
+       found = json.find(key, found + 1)) {
+    at = found + key.size();
+    if (expect(":") && expect("{") && expect("\"version\"") && expect(":")) {
+      auto begin = json.c_str() + at;
+      char *end = nullptr;
+      auto version = std::strtol(begin, &end, 10);
+      if (end != begin) {
+        return version;
+      }
+    }
+  }
+  return std::nullopt;
+}
+
 bool Engine::load(flecs::world ecs, const std::filesystem::path &file_name,
                   MainMenuInputHandler &handler) {
   auto input = std::ifstream(file_name);
@@ -70,7 +127,19 @@ bool Engine::load(flecs::world ecs, const std::filesystem::path &file_name,
 
   auto buffer = std::stringstream();
   buffer << input.rdbuf();
-  if (ecs.from_json(buffer.str().c_str()) == nullptr) {
+  auto json = buffer.str();
+  if (savedVersion(json) != saveVersion) {
+    auto f = [](auto, auto &c) {
+      tcod::print(c, {c.get_width() / 2, c.get_height() / 2},
+                  "Saved game is from another version.", color::text,
+                  color::background, TCOD_CENTER);
+    };
+    makePopup<decltype(f)>(ecs, f, handler);
+    return false;
+  }
+  if (ecs.from_json(json.c_str()) == nullptr) {
+    // Don't leave what was read before the error lying around.
+    clear_game_data(ecs);
     auto f = [](auto, auto &c) {
       tcod::print(c, {c.get_width() / 2, c.get_height() / 2},
                   "Failed to load save.", color::text, color::background,
@@ -93,6 +162,7 @@ bool Engine::load(flecs::world ecs, const std::filesystem::path &file_name,
   auto map = currentmap.target<CurrentMap>();
   auto &gamemap = map.get_mut<GameMap>();
   gamemap.init();
+  gamemap.reindex(map);
   auto player = ecs.lookup("player");
   const auto cfg = roomAccretion::Config{};
   roomAccretion::generateDungeon(cfg, map, gamemap, player, false);
@@ -159,4 +229,7 @@ void Engine::clear_game_data(flecs::world ecs) {
   auto log = ecs.lookup("messageLog");
   if (log)
     log.destruct();
+  auto version = ecs.lookup("saveVersion");
+  if (version)
+    version.destruct();
 }
@@ -14,6 +14,10 @@ struct Turn {
   int64_t turn;
 };
 
+struct SaveVersion {
+  int32_t version;
+};
+
 namespace Engine {
 
 void handle_enemy_turns(flecs::world ecs);
@@ -1,10 +1,14 @@
 #pragma once
 #include "actor.hpp"
 #include "game_map.hpp"
+#include "thread_pool.hpp"
 
+#include <algorithm>
 #include <array>
 #include <cmath>
+#include <cstdint>
 #include <optional>
+#include <vector>
 
 enum class Quadrant {
   North,
@@ -16,6 +20,23 @@ enum class Quadrant {
 static constexpr auto quadrants = std::array<Quadrant, 4>{
     Quadrant::North, Quadrant::East, Quadrant::South, Quadrant::West};
 
+// Where tile, as {depth, col} out from origin in quad, is on the map.
+static std::array<int, 2> transform(Quadrant quad, std::array<int, 2> origin,
+                                    std::array<int, 2> tile) {
+  switch (quad) {
+  case Quadrant::North:
+    return {origin[0] + tile[1], origin[1] - tile[0]};
+  case Quadrant::East:
+    return {origin[0] + tile[0], origin[1] + tile[1]};
+  case Quadrant::South:
+    return {origin[0] + tile[1], origin[1] + tile[0]};
+  case Quadrant::West:
+    return {origin[0] - tile[0], origin[1] + tile[1]};
+  }
+  assert(false);
+  return {-1, -1};
+}
+
 struct Row {
   std::array<int, 2> origin;
   Quadrant quad;
@@ -30,18 +51,7 @@ struct Row {
   };
 
   std::array<int, 2> transform(std::array<int, 2> tile) const {
-    switch (quad) {
-    case Quadrant::North:
-      return {origin[0] + tile[1], origin[1] - tile[0]};
-    case Quadrant::East:
-      return {origin[0] + tile[0], origin[1] + tile[1]};
-    case Quadrant::South:
-      return {origin[0] + tile[1], origin[1] + tile[0]};
-    case Quadrant::West:
-      return {origin[0] - tile[0], origin[1] + tile[1]};
-    }
-    assert(false);
-    return {-1, -1};
+    return ::transform(quad, origin, tile);
   }
 
   bool is_symmetric(std::array<int, 2> tile) {
@@ -65,9 +75,17 @@ static double slope(std::array<int, 2> tile) {
   return (2.0 * tile[1] - 1) / (2.0 * tile[0]);
 }
 
+// The original caster, with float slopes and a call per row. computeFov has to
+// see exactly what this does, so it stays as the reference that
+// tests/fov_diff.cpp checks it against. Its slopes are only exact out to a
+// depth of 10 or so, and a portal next to another can send it round forever.
+// Rows further out than radius are left alone, and so is every tile past it.
+// A radius of 0 doesn't limit anything.
 template <typename F, typename Mappable>
-static void scan(Mappable &map, flecs::query<const Position> &q, Row row,
-                 F callback) {
+static void scanReference(Mappable &map, Row row, int radius, F callback) {
+  if (radius > 0 && row.dx > radius) {
+    return;
+  }
   auto prev_tile = std::optional<std::array<int, 2>>(std::nullopt);
   for (auto col = (int)std::floor(row.depth * row.startSlope + 0.5);
        col <= (int)std::ceil(row.depth * row.endSlope - 0.5); col++) {
@@ -75,7 +93,8 @@ static void scan(Mappable &map, flecs::query<const Position> &q, Row row,
     auto tile = std::array{row.depth, col};
     if (!map.inBounds(row.transform(tile)))
       continue;
-    if (isWall(map, row, tile) || row.is_symmetric(tile)) {
+    auto inRange = radius == 0 || r2 <= radius * radius;
+    if (inRange && (isWall(map, row, tile) || row.is_symmetric(tile))) {
       callback(row.transform(tile), r2);
     }
     if (prev_tile && isWall(map, row, *prev_tile) && isFloor(map, row, tile)) {
@@ -84,94 +103,215 @@ static void scan(Mappable &map, flecs::query<const Position> &q, Row row,
     if (prev_tile && isFloor(map, row, *prev_tile) && isWall(map, row, tile)) {
       auto nextRow = row.next();
       nextRow.endSlope = slope(tile);
-      scan(map, q, nextRow, callback);
+      scanReference(map, nextRow, radius, callback);
     }
-    auto portals = std::vector<Position>{};
-    q.each([&](flecs::iter &it, size_t, const Position &p) {
-      if (p == row.transform(tile)) {
-        auto otherSide = it.pair(1).second();
-        assert(p != otherSide.get<Position>());
-        portals.push_back(otherSide.get<Position>());
-      }
-    });
-    for (auto p : portals) {
+    auto exit = map.portalExit(row.transform(tile));
+    if (inRange && exit) {
+      assert(*exit != row.transform(tile));
       callback(row.transform(tile), r2);
-      scan(map, q,
-           {p, row.quad, 1, row.dx, row.dy + col, slope(tile),
+      scanReference(map,
+           {*exit, row.quad, 1, row.dx, row.dy + col, slope(tile),
             slope({tile[0], tile[1] + 1})},
-           callback);
+           radius, callback);
     }
     prev_tile = tile;
   }
   if (prev_tile && isFloor(map, row, *prev_tile)) {
-    scan(map, q, row.next(), callback);
+    scanReference(map, row.next(), radius, callback);
   }
 }
 
 template <typename F, typename Mappable>
-static void computeFov(flecs::entity mapEntity, Mappable &map,
-                       std::array<int, 2> origin, F callback) {
+static void computeFovReference(Mappable &map, std::array<int, 2> origin,
+                                int radius, F callback) {
+  callback(origin, 0);
 
-  for (auto y = 0; y < map.getHeight(); y++) {
-    for (auto x = 0; x < map.getWidth(); x++) {
-      callback(std::array{x, y}, -1);
-    }
+  for (auto quad : quadrants) {
+    scanReference(map, {origin, quad, 1, 0, 0, -1.0, 1.0}, radius, callback);
   }
+}
 
-  auto ecs = mapEntity.world();
-  auto q = ecs.query_builder<const Position>()
-               .with(ecs.component<Portal>(), flecs::Wildcard)
-               .with(flecs::ChildOf, mapEntity)
-               .build();
+// A slope as an exact fraction, num / den with den > 0. Every slope the caster
+// meets is -1, 1 or (2 * col - 1) / (2 * depth), so ints hold them exactly.
+struct Slope {
+  int num;
+  int den;
+};
 
+static Slope tileSlope(std::array<int, 2> tile) {
+  return {2 * tile[1] - 1, 2 * tile[0]};
+}
+
+// a / b rounded down and up, for b > 0.
+static int floorDiv(int a, int b) {
+  return a / b - (a % b != 0 && a < 0 ? 1 : 0);
+}
+static int ceilDiv(int a, int b) { return -floorDiv(-a, b); }
+
+// A row on the caster's work stack. It carries how far along its columns it
+// is, so it can be set aside while a row it spawned is scanned and then pick
+// up where it left off.
+struct ScanRow {
+  enum Tile : int8_t { None, Wall, Floor };
+
+  std::array<int, 2> origin;
+  Quadrant quad;
+  int depth;
+  int dx;
+  int dy;
+  Slope start;
+  Slope end;
+  int col;
+  int last;
+  Tile prev = None;
+  // col has been looked at already, all that is left is its portal.
+  bool portalPending = false;
+
+  ScanRow(std::array<int, 2> origin, Quadrant quad, int depth, int dx, int dy,
+          Slope start, Slope end)
+      : origin(origin), quad(quad), depth(depth), dx(dx), dy(dy), start(start),
+        end(end),
+        col(floorDiv(2 * depth * start.num + start.den, 2 * start.den)),
+        last(ceilDiv(2 * depth * end.num - end.den, 2 * end.den)) {}
+
+  ScanRow next(Slope endSlope) const {
+    return {origin, quad, depth + 1, dx + 1, dy, start, endSlope};
+  }
+
+  std::array<int, 2> transform(std::array<int, 2> tile) const {
+    return ::transform(quad, origin, tile);
+  }
+
+  bool isSymmetric(int c) const {
+    return c * start.den >= depth * start.num && c * end.den <= depth * end.num;
+  }
+};
+
+// The same cast as scanReference, tile for tile and in the same order, with
+// integer slopes and its own stack in place of recursion.
+template <typename F, typename Mappable>
+static void scan(Mappable &map, std::vector<ScanRow> &stack, int radius,
+                 F &callback) {
+  auto push = [&](ScanRow row) {
+    if (radius == 0 || row.dx <= radius) {
+      stack.push_back(row);
+    }
+  };
+  while (!stack.empty()) {
+    auto row = stack.back();
+    stack.pop_back();
+    auto descended = false;
+    while (!descended && row.col <= row.last) {
+      auto tile = std::array{row.depth, row.col};
+      auto xy = row.transform(tile);
+      auto r2 = row.dx * row.dx + (row.dy + row.col) * (row.dy + row.col);
+      auto inRange = radius == 0 || r2 <= radius * radius;
+      if (!row.portalPending) {
+        if (!map.inBounds(xy)) {
+          row.col++;
+          continue;
+        }
+        auto wall = !map.isTransparent(xy);
+        if (inRange && (wall || row.isSymmetric(row.col))) {
+          callback(xy, r2);
+        }
+        if (row.prev == ScanRow::Wall && !wall) {
+          row.start = tileSlope(tile);
+        }
+        auto spawn = row.prev == ScanRow::Floor && wall;
+        row.prev = wall ? ScanRow::Wall : ScanRow::Floor;
+        if (spawn) {
+          row.portalPending = true;
+          stack.push_back(row);
+          push(row.next(tileSlope(tile)));
+          descended = true;
+          continue;
+        }
+      }
+      row.portalPending = false;
+      row.col++;
+      auto exit = map.portalExit(xy);
+      if (inRange && exit) {
+        assert(*exit != xy);
+        callback(xy, r2);
+        stack.push_back(row);
+        push({*exit, row.quad, 1, row.dx, row.dy + tile[1], tileSlope(tile),
+              tileSlope({tile[0], tile[1] + 1})});
+        descended = true;
+      }
+    }
+    if (!descended && row.prev == ScanRow::Floor) {
+      push(row.next(row.end));
+    }
+  }
+}
+
+// callback(xy, r2) for every tile in view from origin, out to radius. Tiles
+// out of view aren't visited at all.
+template <typename F, typename Mappable>
+static void computeFov(Mappable &map, std::array<int, 2> origin, int radius,
+                       F callback) {
   callback(origin, 0);
 
+  auto stack = std::vector<ScanRow>();
+  stack.reserve(32);
   for (auto quad : quadrants) {
-    scan(map, q, {origin, quad, 1, 0, 0, -1.0, 1.0}, callback);
+    stack.push_back({origin, quad, 1, 0, 0, {-1, 1}, {1, 1}});
+    scan(map, stack, radius, callback);
   }
 }
 
-template <typename Mappable>
-void computeFov(flecs::entity mapEntity, Mappable &map,
-                std::array<int, 2> origin, int maxRadius) {
-  if (maxRadius == 0) {
-    computeFov(mapEntity, map, origin,
-               [&](auto xy, auto r2) { map.setFov(xy, r2 >= 0); });
-  } else {
-    computeFov(mapEntity, map, origin, [&](auto xy, auto r2) {
-      map.setFov(xy, 0 <= r2 && r2 <= maxRadius * maxRadius);
-    });
+// computeFov with the four quadrants cast at once on pool, each into a buffer
+// of its own. callback still runs on the caller, after every quadrant is in,
+// and sees the tiles in the same order computeFov gives them, as
+// tests/fov_diff.cpp checks. Waking the workers costs more than a short cast,
+// so this only pays off for wide radii.
+template <typename F, typename Mappable>
+static void computeFov(Mappable &map, std::array<int, 2> origin, int radius,
+                       F callback, ThreadPool &pool) {
+  using Seen = std::vector<std::pair<std::array<int, 2>, int>>;
+  auto seen = std::array<Seen, quadrants.size()>();
+  pool.parallelFor(quadrants.size(), [&](size_t i) {
+    auto stack = std::vector<ScanRow>();
+    stack.push_back({origin, quadrants[i], 1, 0, 0, {-1, 1}, {1, 1}});
+    auto record = [&q = seen[i]](std::array<int, 2> xy, int r2) {
+      q.push_back({xy, r2});
+    };
+    scan(map, stack, radius, record);
+  });
+
+  callback(origin, 0);
+  for (auto &q : seen) {
+    for (auto &[xy, r2] : q) {
+      callback(xy, r2);
+    }
   }
 }
 
-static void addLumens(flecs::entity mapEntity, GameMap &map,
-                      std::array<int, 2> origin, Light l) {
+// Casts l from origin into stamp, without touching the map's luminosity.
+static inline void castLight(const GameMap &map, std::array<int, 2> origin,
+                             Light l, LightStamp &stamp) {
   auto minR2 = l.innerRadius * l.innerRadius;
   auto maxR2 = (float)(l.outerRadius * l.outerRadius);
-  computeFov(mapEntity, map, origin, [&](auto xy, auto r2) {
+  auto &b = stamp.bounds;
+  b = {origin[0], origin[1], origin[0], origin[1]};
+  auto lit = std::vector<std::pair<std::array<int, 2>, float>>();
+  computeFov(map, origin, l.outerRadius, [&](auto xy, auto r2) {
+    b = {std::min(b[0], xy[0]), std::min(b[1], xy[1]), std::max(b[2], xy[0]),
+         std::max(b[3], xy[1])};
     if (0 <= r2 && r2 < minR2) {
-      map.addLuminosity(xy, 1.0f);
+      lit.push_back({xy, 1.0f});
     } else if (0 <= r2 && (float)r2 < maxR2) {
-      map.addLuminosity(xy, l.decayFactor * (maxR2 - (float)r2) /
-                                (maxR2 - (float)minR2));
+      lit.push_back(
+          {xy, l.decayFactor * (maxR2 - (float)r2) / (maxR2 - (float)minR2)});
     }
   });
-}
-
-static inline void addLight(flecs::entity mapEntity, GameMap &map) {
-  for (auto &l : map.luminosity) {
-    l = 0.0f;
-  }
-
-  mapEntity.world()
-      .query_builder<const Position, const Light>()
-      .with(flecs::ChildOf, mapEntity)
-      .build()
-      .each([&](auto &p, auto &l) { addLumens(mapEntity, map, p, l); });
-
-  auto player = mapEntity.world().lookup("player");
-  assert(player);
-  if (player.has<Light>()) {
-    addLumens(mapEntity, map, player.get<Position>(), player.get<Light>());
+  auto w = b[2] - b[0] + 1;
+  stamp.lumens.assign((size_t)(w * (b[3] - b[1] + 1)), 0.0f);
+  for (auto &[xy, lumens] : lit) {
+    stamp.lumens[(size_t)((xy[1] - b[1]) * w + xy[0] - b[0])] += lumens;
   }
+  stamp.origin = origin;
+  stamp.light = l;
+  stamp.stale = false;
 }
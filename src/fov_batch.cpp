@@ -0,0 +1,27 @@
+#include "fov_batch.hpp"
+
+#include "fov.hpp"
+#include "game_map.hpp"
+
+FovSnapshot::FovSnapshot(const GameMap &map)
+    : width(map.getWidth()), height(map.getHeight()),
+      transparent(map.transparentTiles()),
+      portalSlots((size_t)(width * height), -1), portals(map.portals()) {
+  for (size_t i = 0; i < portals.size(); i++) {
+    auto &p = portals[i][0];
+    portalSlots[(size_t)(p[1] * width + p[0])] = (int)i;
+  }
+}
+
+std::vector<Visibility> computeFovs(const FovSnapshot &snapshot,
+                                    const std::vector<Viewer> &viewers,
+                                    ThreadPool &pool) {
+  auto ret = std::vector<Visibility>(
+      viewers.size(), Visibility(snapshot.getWidth(), snapshot.getHeight()));
+  pool.parallelFor(viewers.size(), [&](size_t i) {
+    auto &v = ret[i];
+    computeFov(snapshot, viewers[i].origin, viewers[i].radius,
+               [&v](auto xy, auto) { v.set(xy); });
+  });
+  return ret;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "bitplane.hpp"
+#include "pathfinding.hpp"
+#include "thread_pool.hpp"
+
+struct GameMap;
+
+// The tiles one viewer can see, a bit per tile of the map.
+class Visibility {
+public:
+  Visibility(int width = 0, int height = 0)
+      : width(width), height(height),
+        bits(((size_t)(width * height) + 63) / 64) {};
+
+  inline bool test(std::array<int, 2> xy) const {
+    if (!inBounds(xy)) {
+      return false;
+    }
+    auto i = (size_t)(xy[1] * width + xy[0]);
+    return (bits[i / 64] >> (i % 64)) & 1;
+  }
+  inline void set(std::array<int, 2> xy) {
+    auto i = (size_t)(xy[1] * width + xy[0]);
+    bits[i / 64] |= uint64_t(1) << (i % 64);
+  }
+  // f(xy) for every visible tile, in row order.
+  template <typename F> void forEach(F &&f) const {
+    for (size_t w = 0; w < bits.size(); w++) {
+      if (bits[w] == 0) {
+        continue;
+      }
+      for (size_t b = 0; b < 64; b++) {
+        if ((bits[w] >> b) & 1) {
+          auto i = (int)(w * 64 + b);
+          f(std::array{i % width, i / width});
+        }
+      }
+    }
+  }
+
+private:
+  inline bool inBounds(std::array<int, 2> xy) const {
+    return 0 <= xy[0] && xy[0] < width && 0 <= xy[1] && xy[1] < height;
+  }
+
+  int width;
+  int height;
+  std::vector<uint64_t> bits;
+};
+
+// What shadowcasting needs from a GameMap, copied out so any number of threads
+// can cast over it at once. It is a Mappable for computeFov.
+class FovSnapshot {
+public:
+  FovSnapshot() = default;
+  explicit FovSnapshot(const GameMap &map);
+
+  inline int getWidth() const { return width; }
+  inline int getHeight() const { return height; }
+  inline bool inBounds(std::array<int, 2> xy) const {
+    return 0 <= xy[0] && xy[0] < width && 0 <= xy[1] && xy[1] < height;
+  }
+  inline bool isTransparent(std::array<int, 2> xy) const {
+    return transparent.test(xy[0], xy[1]);
+  }
+  inline std::optional<std::array<int, 2>>
+  portalExit(std::array<int, 2> xy) const {
+    if (!inBounds(xy)) {
+      return std::nullopt;
+    }
+    auto slot = portalSlots[(size_t)(xy[1] * width + xy[0])];
+    if (slot < 0) {
+      return std::nullopt;
+    }
+    return portals[(size_t)slot][1];
+  }
+
+private:
+  int width = 0;
+  int height = 0;
+  BitPlane transparent;
+  std::vector<int> portalSlots;
+  std::vector<pathfinding::PortalPair> portals;
+};
+
+struct Viewer {
+  std::array<int, 2> origin;
+  int radius;
+};
+
+// Every viewer's field of view over the snapshot, spread across the pool, in
+// the same order as viewers.
+std::vector<Visibility> computeFovs(const FovSnapshot &snapshot,
+                                    const std::vector<Viewer> &viewers,
+                                    ThreadPool &pool = ThreadPool::shared());
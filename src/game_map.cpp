@@ -1,10 +1,14 @@
 #include "game_map.hpp"
 
+#include <algorithm>
 #include <cstddef>
 
 #include "color.hpp"
 #include "defines.hpp"
 #include "fov.hpp"
+#include "inventory.hpp"
+#include "lightmap.hpp"
+#include "map_shared.hpp"
 #include "room_accretion.hpp"
 #include "scent.hpp"
 
@@ -43,7 +47,28 @@ void deleteMapEntity(flecs::world ecs) {
   }
 }
 
-void GameMap::carveOut(int x, int y) { map.setProperties(x, y, true, true); }
+void GameMap::carveOut(int x, int y) {
+  if (!transparent.test(x, y)) {
+    invalidateLights({x, y});
+    if (los) {
+      los->invalidate({x, y});
+    }
+  }
+  map.setProperties(x, y, true, true);
+  transparent.set(x, y, true);
+  walkable.set(x, y, true);
+  version++;
+  record({x, y});
+}
+
+void GameMap::record(pathfinding::Index xy) {
+  if (journal.size() >= std::max((size_t)(width * height), size_t(64))) {
+    auto drop = journal.size() / 2;
+    journal.erase(journal.begin(), journal.begin() + (std::ptrdiff_t)drop);
+    journalStart += drop;
+  }
+  journal.push_back(xy);
+}
 
 void GameMap::nextFloor(flecs::entity player, bool lit) const {
   auto ecs = player.world();
@@ -142,72 +167,234 @@ void GameMap::render(tcod::Console &console, uint64_t time) {
 
 void GameMap::update_fov(flecs::entity mapEntity, flecs::entity player) {
   auto pos = player.get<Position>();
-  computeFov(mapEntity, *this, pos, 8);
-  if (lit) {
-    for (auto &l : luminosity) {
-      l = 1.0f;
+  // Only what was in view last time can still be marked.
+  for (auto y = fovBox[1]; y <= fovBox[3]; y++) {
+    for (auto x = fovBox[0]; x <= fovBox[2]; x++) {
+      setFov({x, y}, false);
     }
+  }
+  fovBox = {pos.x, pos.y, pos.x, pos.y};
+  auto see = [&](auto xy, auto...) {
+    setFov(xy, true);
+    fovBox = {std::min(fovBox[0], xy[0]), std::min(fovBox[1], xy[1]),
+              std::max(fovBox[2], xy[0]), std::max(fovBox[3], xy[1])};
+  };
+  if (auto cache = losCache()) {
+    cache->forEach(*this, pos, see);
   } else {
-    addLight(mapEntity, *this);
+    computeFov(*this, pos, fovRadius, see);
   }
-  for (auto y = 0; y < height; y++) {
-    for (auto x = 0; x < width; x++) {
-      if (isVisible(x, y)) {
-        auto &tile = tiles[(size_t)(y * width + x)];
-        tile.flags |= Tile::Explored;
-        if (tile.flags & Tile::Bloody)
-          tile.flags |= Tile::KnownBloody;
+  if (lit) {
+    std::fill(luminosity.begin(), luminosity.end(), 1.0f);
+  } else {
+    addLight(mapEntity);
+  }
+  auto n = (size_t)(fovBox[2] - fovBox[0] + 1);
+  for (auto y = fovBox[1]; y <= fovBox[3]; y++) {
+    auto i = (size_t)(y * width + fovBox[0]);
+    mergeVisible(&tiles[i], &inView[i], &luminosity[i], n);
+    for (auto x = fovBox[0]; x <= fovBox[2]; x++) {
+      auto &tile = tiles[(size_t)(y * width + x)];
+      if ((tile.flags & Tile::Explored) && !explored.test(x, y)) {
+        record({x, y});
+        explored.set(x, y, true);
+      }
+    }
+  }
+
+  inViewEntities.clear();
+  for (auto y = fovBox[1]; y <= fovBox[3]; y++) {
+    for (auto x = fovBox[0]; x <= fovBox[2]; x++) {
+      if (inView[(size_t)(y * width + x)]) {
+        auto &here = spatial.at({x, y});
+        inViewEntities.insert(inViewEntities.end(), here.begin(), here.end());
       }
     }
   }
 }
 
-static constexpr auto decayFactor = 0.9f;
-static constexpr auto decayThreshold = 1.0f;
+static inline bool operator==(const Light &lhs, const Light &rhs) {
+  return lhs.innerRadius == rhs.innerRadius &&
+         lhs.outerRadius == rhs.outerRadius &&
+         lhs.decayFactor == rhs.decayFactor;
+}
+
+void GameMap::addLight(flecs::entity mapEntity) {
+  auto order = std::vector<flecs::entity_t>();
+  auto changed = !lightOrder;
+  auto stamp = [&](flecs::entity e, const Position &p, const Light &l) {
+    auto &s = lightStamps[e.id()];
+    if (s.stale || !(s.origin == p) || !(s.light == l)) {
+      castLight(*this, p, l, s);
+      changed = true;
+    }
+    order.push_back(e.id());
+  };
+  mapEntity.world()
+      .query_builder<const Position, const Light>("module::lights")
+      .with(flecs::ChildOf, mapEntity)
+      .build()
+      .each([&](flecs::entity e, const Position &p, const Light &l) {
+        stamp(e, p, l);
+      });
+  auto player = mapEntity.world().lookup("player");
+  assert(player);
+  if (player.has<Light>()) {
+    stamp(player, player.get<Position>(), player.get<Light>());
+  }
+
+  if (!changed && order == *lightOrder) {
+    return;
+  }
+  for (auto it = lightStamps.begin(); it != lightStamps.end();) {
+    if (std::find(order.begin(), order.end(), it->first) == order.end()) {
+      it = lightStamps.erase(it);
+    } else {
+      it++;
+    }
+  }
+  std::fill(luminosity.begin(), luminosity.end(), 0.0f);
+  for (auto id : order) {
+    auto &s = lightStamps[id];
+    auto &b = s.bounds;
+    auto n = (size_t)(b[2] - b[0] + 1);
+    for (auto y = b[1]; y <= b[3]; y++) {
+      accumulateLight(&luminosity[(size_t)(y * width + b[0])],
+                      &s.lumens[(size_t)(y - b[1]) * n], n);
+    }
+  }
+  lightOrder = std::move(order);
+}
+
+void GameMap::invalidateLights(std::array<int, 2> xy) {
+  for (auto &[id, s] : lightStamps) {
+    auto &b = s.bounds;
+    auto near = pathfinding::chebyshev(xy, s.origin) <= s.light.outerRadius;
+    auto seen = b[0] - 1 <= xy[0] && xy[0] <= b[2] + 1 && b[1] - 1 <= xy[1] &&
+                xy[1] <= b[3] + 1;
+    if (near || seen) {
+      s.stale = true;
+    }
+  }
+}
+
+const FovSnapshot &GameMap::fovSnapshot() {
+  if (snapshot.getWidth() != width || snapshotVersion != version) {
+    snapshot = FovSnapshot(*this);
+    snapshotVersion = version;
+  }
+  return snapshot;
+}
+
+void GameMap::perceive(
+    const std::vector<std::pair<flecs::entity, Viewer>> &viewers) {
+  auto cache = losCache();
+  auto cached = [&](const Viewer &v) { return cache && v.radius == fovRadius; };
+  auto batch = std::vector<Viewer>();
+  auto origins = std::vector<std::array<int, 2>>();
+  for (auto &[e, v] : viewers) {
+    if (cached(v)) {
+      origins.push_back(v.origin);
+    } else {
+      batch.push_back(v);
+    }
+  }
+  if (cache) {
+    cache->fill(*this, origins);
+  }
+  auto visible = computeFovs(fovSnapshot(), batch);
+  sights.clear();
+  auto next = visible.begin();
+  for (auto &[e, v] : viewers) {
+    auto sight = Sight{v, version, {}};
+    sight.visible =
+        cached(v) ? cachedSight(*cache, v.origin) : std::move(*next++);
+    sights.insert_or_assign(e.id(), std::move(sight));
+  }
+}
+
+const Visibility &GameMap::sightOf(flecs::entity e, std::array<int, 2> origin,
+                                   int radius) {
+  auto it = sights.find(e.id());
+  if (it != sights.end() && it->second.viewer.origin == origin &&
+      it->second.viewer.radius == radius && it->second.version == version) {
+    return it->second.visible;
+  }
+  auto viewer = Viewer{origin, radius};
+  auto sight = Sight{viewer, version, {}};
+  auto cache = losCache();
+  if (cache && radius == fovRadius) {
+    sight.visible = cachedSight(*cache, origin);
+  } else {
+    sight.visible = std::move(computeFovs(fovSnapshot(), {viewer})[0]);
+  }
+  it = sights.insert_or_assign(e.id(), std::move(sight)).first;
+  return it->second.visible;
+}
+
+LosCache *GameMap::losCache() {
+  if (!cacheLos) {
+    return nullptr;
+  }
+  if (!los) {
+    los.emplace(width, height, fovRadius);
+  }
+  return &*los;
+}
+
+Visibility GameMap::cachedSight(LosCache &cache, std::array<int, 2> origin) {
+  auto ret = Visibility(width, height);
+  cache.forEach(*this, origin, [&ret](auto xy) { ret.set(xy); });
+  return ret;
+}
+
+// Scent keeps nine tenths of its power each turn, and is gone once under one.
+static constexpr auto scentDecay = ScentField::Decay{9, 10, TileScent::one};
+// Floors at least this big spread scent over the shared pool, a band of rows
+// to each job. Below it, waking the workers costs more than it saves.
+static constexpr auto poolScentArea = 128 * 128;
+static constexpr auto scentBandHeight = 16;
 
 void GameMap::update_scent(flecs::entity map) {
-  auto q = map.world()
-               .query_builder<const Scent, const Position>("module::scent")
-               .with(flecs::ChildOf, map)
-               .build();
-  q.each([&](auto s, auto p) { getScent(p) += s; });
+  auto deposit = [this](const Position &p, const Scent &s) {
+    getScent(p) += s;
+    scentField.touch((size_t)(p.y * width + p.x));
+  };
+  for (auto &e : scentSources) {
+    auto s = e.try_get<Scent>();
+    auto p = e.try_get<Position>();
+    if (s && p) {
+      deposit(*p, *s);
+    }
+  }
   auto player = map.world().lookup("player");
-  getScent(player.get<Position>()) += player.get<Scent>();
+  deposit(player.get<Position>(), player.get<Scent>());
 
-  auto newScents = std::vector<Scent>(width * height);
-  for (auto y = 0; y < height; y++) {
-    for (auto x = 0; x < width; x++) {
-      if (!isTransparent(x, y)) {
-        continue;
-      }
+  backScent.resize(scent.size());
+  auto pool = width * height >= poolScentArea ? &ThreadPool::shared() : nullptr;
+  scentField.diffuse(scent, transparent, backScent, scentDecay, pool,
+                     scentBandHeight);
+  scent.swap(backScent);
+}
 
-      std::array<float, static_cast<size_t>(ScentType::MAX)> levels = {};
-      std::array<int, static_cast<size_t>(ScentType::MAX)> count = {};
-      auto &s = getScent({x, y});
-      levels[static_cast<size_t>(s.type)] = s.power;
-      count[static_cast<size_t>(s.type)]++;
-      for (auto &dir : directions) {
-        auto x2 = x + dir[0];
-        auto y2 = y + dir[1];
-        if (inBounds(x2, y2) && isTransparent(x2, y2)) {
-          auto &s = getScent({x2, y2});
-          levels[static_cast<size_t>(s.type)] += s.power;
-          count[static_cast<size_t>(s.type)]++;
-        }
-      }
+static bool byId(flecs::entity lhs, flecs::entity rhs) {
+  return lhs.id() < rhs.id();
+}
 
-      auto idx =
-          std::max_element(levels.begin(), levels.end()) - levels.begin();
-      auto &newS = newScents[y * width + x];
-      newS = {static_cast<ScentType>(idx),
-              decayFactor * (levels[idx] / (float)count[idx])};
-      if (newS.type == ScentType::none || newS.power < decayThreshold) {
-        newS = {ScentType::none, 0.0f};
-      }
-    }
+void GameMap::addScentSource(flecs::entity e) {
+  auto it =
+      std::lower_bound(scentSources.begin(), scentSources.end(), e, byId);
+  if (it == scentSources.end() || *it != e) {
+    scentSources.insert(it, e);
   }
+}
 
-  scent = newScents;
+void GameMap::removeScentSource(flecs::entity e) {
+  auto it =
+      std::lower_bound(scentSources.begin(), scentSources.end(), e, byId);
+  if (it != scentSources.end() && *it == e) {
+    scentSources.erase(it);
+  }
 }
 
 void GameMap::reveal() {
@@ -231,8 +418,8 @@ ScentType GameMap::detectScent(flecs::entity e,
       strongest = {dir[0], dir[1]};
     }
   }
-  if (getScent(pos + strongest).power > smeller->threshold) {
-    return getScent(pos + strongest).type;
+  if (getScent(pos + strongest).strength() > smeller->threshold) {
+    return getScent(pos + strongest).kind();
   }
   strongest = {0, 0};
   return ScentType::none;
@@ -256,16 +443,166 @@ std::string GameMap::detectScent(flecs::entity e) const {
                        dir.c_str());
 }
 
+pathfinding::Neighbours GameMap::movesFrom(pathfinding::Index xy, bool flying,
+                                           bool throughDoors) const {
+  auto ret = pathfinding::Neighbours();
+  for (auto &dir : directions) {
+    auto next = pathfinding::Index{xy[0] + dir[0], xy[1] + dir[1]};
+    if (inBounds(next) && (isWalkable(next) || (flying && isFlyable(next)))) {
+      ret.push_back(next);
+    } else if (throughDoors && entityAt<Openable>(next)) {
+      ret.push_back(next);
+    }
+  }
+  if (auto exit = portalExit(xy)) {
+    ret.push_back(*exit);
+  }
+  return ret;
+}
+
+int GameMap::moveCost(pathfinding::Index xy) const {
+  if (entityAt<Openable>(xy) && !isWalkable(xy)) {
+    return 2;
+  }
+  return 1;
+}
+
+std::optional<pathfinding::Index>
+GameMap::fleeStep(const Position &from, const Position &player, bool flying) {
+  auto &field = fleeFields[flying ? 1 : 0];
+  if (!field.search || !(field.origin == player) || field.version != version) {
+    auto dij = pathfinding::Dijkstra(
+        {width, height}, [&](auto xy) { return player == xy; },
+        [&](auto &xy) { return movesFrom(xy, flying, true); },
+        [&](auto xy) { return moveCost(xy); }, pathfinding::BucketQueue<2>(),
+        borrowSearch());
+    dij.scan();
+    dij *= -1.2f;
+    dij.rescan();
+
+    field.origin = player;
+    field.version = version;
+    field.search = dij.release();
+  }
+
+  auto xy = pathfinding::CameFrom(field.search.get())[from];
+  if (xy[0] < 0) {
+    return std::nullopt;
+  }
+  return xy;
+}
+
+std::vector<pathfinding::Index> GameMap::chasePlayer(const Position &from,
+                                                     const Position &player,
+                                                     bool flying) const {
+  auto astar = pathfinding::AStar(
+      {width, height}, [&](auto xy) { return player == xy; },
+      [&](auto &xy) { return movesFrom(xy, flying); },
+      [&](auto xy) { return moveCost(xy); }, portalTable, borrowSearch());
+  // Seeded from the player alone, so it doesn't ask about every tile.
+  astar.scan(player, from);
+  return pathfinding::constructPath(player, from, astar.cameFrom);
+}
+
+void GameMap::buildRoomGraph(const std::vector<RectangularRoom> &rooms) {
+  auto roomOf = std::vector<int>((size_t)(width * height), -1);
+  for (size_t i = 0; i < rooms.size(); i++) {
+    const auto &rm = rooms[i];
+    for (auto y = rm.y1 + 1; y < rm.y2; y++) {
+      for (auto x = rm.x1 + 1; x < rm.x2; x++) {
+        roomOf[(size_t)(y * width + x)] = (int)i;
+      }
+    }
+  }
+  auto cost = std::vector<int>((size_t)(width * height), 0);
+  for (auto y = 0; y < height; y++) {
+    for (auto x = 0; x < width; x++) {
+      if (isWalkable(x, y)) {
+        cost[(size_t)(y * width + x)] = 1;
+      } else if (entityAt<Openable>({x, y})) {
+        cost[(size_t)(y * width + x)] = 2;
+      }
+    }
+  }
+  graph = pathfinding::RoomGraph({width, height}, roomOf, cost, portalTable);
+}
+
 flecs::entity GameMap::get_blocking_entity(flecs::entity map,
                                            const Position &pos) {
   auto player = map.world().lookup("player");
   if (player.get<Position>() == pos) {
     return player;
   }
-  auto q = map.world()
-               .query_builder<const Position>("module::blocksPosition")
-               .with(flecs::ChildOf, map)
-               .with<BlocksMovement>()
+  return map.get<GameMap>().entityAt<BlocksMovement>(pos);
+}
+
+// Only items go in the journal. Nothing that paths over the map cares where
+// monsters stand.
+void GameMap::index(flecs::entity e, std::array<int, 2> xy) {
+  if (e.has<Item>()) {
+    auto old = spatial.locate(e);
+    if (old) {
+      record(*old);
+    }
+    record(xy);
+  }
+  spatial.insert(e, xy);
+  trackView(e, xy);
+}
+
+void GameMap::moveIndexed(flecs::entity e, std::array<int, 2> xy) {
+  if (spatial.locate(e)) {
+    index(e, xy);
+  }
+}
+
+void GameMap::unindex(flecs::entity e) {
+  if (e.has<Item>()) {
+    auto old = spatial.locate(e);
+    if (old) {
+      record(*old);
+    }
+  }
+  spatial.erase(e);
+  trackView(e, std::nullopt);
+}
+
+void GameMap::trackView(flecs::entity e,
+                        std::optional<std::array<int, 2>> xy) {
+  // While a save loads, the observers index children as soon as width and
+  // height are in, before init() has sized inView to match.
+  auto i = xy && inBounds(*xy) ? (size_t)((*xy)[1] * width + (*xy)[0])
+                               : inView.size();
+  auto seen = i < inView.size() && inView[i];
+  auto it = std::find(inViewEntities.begin(), inViewEntities.end(), e);
+  if (seen && it == inViewEntities.end()) {
+    inViewEntities.push_back(e);
+  } else if (!seen && it != inViewEntities.end()) {
+    inViewEntities.erase(it);
+  }
+}
+
+void GameMap::reindex(flecs::entity mapEntity) {
+  spatial.clear();
+  auto q = mapEntity.world()
+               .query_builder<const Position>("module::position")
+               .with(flecs::ChildOf, mapEntity)
                .build();
-  return q.find([&](const auto &p) { return p == pos; });
+  portalTable.clear();
+  portalSlots.assign((size_t)(width * height), -1);
+  inViewEntities.clear();
+  scentSources.clear();
+  q.each([this](flecs::entity e, const Position &p) {
+    spatial.insert(e, p);
+    trackView(e, p);
+    if (e.has<Scent>()) {
+      addScentSource(e);
+    }
+    if (e.has<Portal>(flecs::Wildcard)) {
+      auto exit = e.target<Portal>().try_get<Position>();
+      if (exit && inBounds(p)) {
+        addPortalEntry(p, *exit);
+      }
+    }
+  });
 }
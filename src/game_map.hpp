@@ -2,14 +2,25 @@
 
 #include <cassert>
 #include <cstdint>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <flecs.h>
 #include <libtcod.hpp>
 
 #include "actor.hpp"
+#include "bitplane.hpp"
 #include "color.hpp"
+#include "fov_batch.hpp"
+#include "los_cache.hpp"
+#include "pathfinding.hpp"
+#include "room_graph.hpp"
 #include "scent.hpp"
+#include "scent_field.hpp"
+#include "spatial_index.hpp"
 
 struct BlocksMovement {};
 struct BlocksFov {};
@@ -24,6 +35,18 @@ struct Light {
 
 struct CurrentMap {};
 
+// What one light adds to the luminosity of each tile it reaches. Kept until
+// the light changes or the walls near it do.
+struct LightStamp {
+  Position origin;
+  Light light = {0, 0, 0.0f};
+  std::array<int, 4> bounds = {0, 0, -1, -1}; // Every tile the cast looked at.
+  std::vector<float> lumens;                   // Row by row over bounds.
+  bool stale = true;
+};
+
+struct RectangularRoom;
+
 struct Tile {
   uint8_t flags;
 
@@ -35,6 +58,14 @@ struct Tile {
   static constexpr auto Water = uint8_t(0x20);
 };
 
+// A Dijkstra map seeded on the player, shared by every monster that moves the
+// same way. It stays valid until the player moves or the terrain changes.
+struct PlayerField {
+  Position origin;
+  uint64_t version = 0;
+  pathfinding::Lease search;
+};
+
 void deleteMapEntity(flecs::entity map);
 void deleteMapEntity(flecs::world ecs);
 
@@ -42,11 +73,42 @@ struct GameMap {
   GameMap(int width = 0, int height = 0, int level = 1, bool lit = true)
       : width(width), height(height), level(level), lit(lit),
         tiles(width * height), scent(width * height),
-        luminosity(width * height), map(width, height), noise(3) {
+        luminosity(width * height), map(width, height), noise(3),
+        searches(std::make_shared<pathfinding::Pool>()),
+        spatial(width, height), portalSlots((size_t)(width * height), -1),
+        inView((size_t)(width * height), 0), walkable(width, height),
+        transparent(width, height), explored(width, height),
+        water(width, height), scentField(width, height) {
     map.clear();
   };
 
-  void init() { map = TCODMap(width, height); }
+  void init() {
+    map = TCODMap(width, height);
+    luminosity.resize((size_t)(width * height));
+    spatial = SpatialIndex(width, height);
+    portalTable.clear();
+    portalSlots.assign((size_t)(width * height), -1);
+    inView.assign((size_t)(width * height), 0);
+    inViewEntities.clear();
+    fovBox = {0, 0, -1, -1};
+    los.reset();
+    lightStamps.clear();
+    lightOrder.reset();
+    snapshot = FovSnapshot();
+    sights.clear();
+    walkable = BitPlane(width, height);
+    transparent = BitPlane(width, height);
+    explored = BitPlane(width, height);
+    water = BitPlane(width, height);
+    scentField = ScentField(width, height);
+    for (auto y = 0; y < height; y++) {
+      for (auto x = 0; x < width; x++) {
+        auto flags = tiles[(size_t)(y * width + x)].flags;
+        explored.set(x, y, flags & Tile::Explored);
+        water.set(x, y, flags & Tile::Water);
+      }
+    }
+  }
 
   inline int getWidth() const { return width; }
   inline int getHeight() const { return height; }
@@ -61,33 +123,31 @@ struct GameMap {
   }
   inline bool canSeePlayer(std::array<int, 2> xy,
                            std::array<int, 2> player) const {
-    return map.isInFov(xy[0], xy[1]) && inLight(player);
+    return inView[(size_t)(xy[1] * width + xy[0])] && inLight(player);
   }
   inline bool isVisible(std::array<int, 2> xy) const {
     return isVisible(xy[0], xy[1]);
   }
   inline bool isVisible(int x, int y) const {
-    return map.isInFov(x, y) && inLight({x, y});
+    return inView[(size_t)(y * width + x)] && inLight({x, y});
   }
   inline void setFov(std::array<int, 2> xy, bool visible) {
-    return map.setInFov(xy[0], xy[1], visible);
+    inView[(size_t)(xy[1] * width + xy[0])] = visible;
   }
   inline bool isTransparent(std::array<int, 2> xy) const {
     return isTransparent(xy[0], xy[1]);
   }
   inline bool isTransparent(int x, int y) const {
-    return inBounds(x, y) && map.isTransparent(x, y);
+    return transparent.test(x, y);
   }
   inline bool isWalkable(std::array<int, 2> xy) const {
-    return inBounds(xy) && isWalkable(xy[0], xy[1]);
+    return isWalkable(xy[0], xy[1]);
   }
-  inline bool isWalkable(int x, int y) const { return map.isWalkable(x, y); }
+  inline bool isWalkable(int x, int y) const { return walkable.test(x, y); }
   inline bool isFlyable(std::array<int, 2> xy) const {
     return isFlyable(xy[0], xy[1]);
   }
-  inline bool isFlyable(int x, int y) const {
-    return inBounds(x, y) && isTransparent(x, y);
-  }
+  inline bool isFlyable(int x, int y) const { return isTransparent(x, y); }
   inline void makeStairs(std::array<int, 2> xy) {
     return makeStairs(xy[0], xy[1]);
   }
@@ -106,9 +166,7 @@ struct GameMap {
   inline bool isKnownBloody(std::array<int, 2> xy) const {
     return tiles[(size_t)(xy[1] * width + xy[0])].flags & Tile::KnownBloody;
   };
-  inline bool isExplored(int x, int y) const {
-    return inBounds(x, y) && (tiles[y * width + x].flags & Tile::Explored);
-  };
+  inline bool isExplored(int x, int y) const { return explored.test(x, y); };
   inline bool isExplored(std::array<int, 2> xy) const {
     return isExplored(xy[0], xy[1]);
   }
@@ -118,8 +176,10 @@ struct GameMap {
   inline bool isSensed(std::array<int, 2> xy) const {
     return isSensed(xy[0], xy[1]);
   }
-  inline bool isWater(int x, int y) const {
-    return inBounds(x, y) && (tiles[y * width + x].flags & Tile::Water);
+  inline bool isWater(int x, int y) const { return water.test(x, y); }
+  inline void makeWater(std::array<int, 2> xy) {
+    tiles[(size_t)(xy[1] * width + xy[0])].flags = Tile::Water;
+    water.set(xy[0], xy[1], true);
   }
   inline bool isWater(std::array<int, 2> xy) const {
     return isWater(xy[0], xy[1]);
@@ -127,18 +187,12 @@ struct GameMap {
   inline bool isChasm(std::array<int, 2> xy) const {
     return isTransparent(xy) && !isWalkable(xy) && !isWater(xy);
   };
-  inline Scent &getScent(std::array<int, 2> xy) {
+  inline TileScent &getScent(std::array<int, 2> xy) {
     return scent[xy[1] * width + xy[0]];
   }
-  inline const Scent &getScent(std::array<int, 2> xy) const {
+  inline const TileScent &getScent(std::array<int, 2> xy) const {
     return scent[xy[1] * width + xy[0]];
   }
-  inline void addLuminosity(std::array<int, 2> xy, float lumens) {
-    assert(0 <= xy[0] && xy[0] < width);
-    assert(0 <= xy[1] && xy[1] < height);
-    auto &l = luminosity[xy[1] * width + xy[0]];
-    l = std::clamp(l + lumens, 0.0f, 1.0f);
-  }
 
   void carveOut(int x, int y);
   void nextFloor(flecs::entity player, bool lit) const;
@@ -148,25 +202,203 @@ struct GameMap {
   void reveal();
   inline const TCODMap &get(void) const { return map; };
   inline void setProperties(int x, int y, bool isTransparent, bool isWalkable) {
+    if (transparent.test(x, y) != isTransparent) {
+      invalidateLights({x, y});
+      if (los) {
+        los->invalidate({x, y});
+      }
+    }
     map.setProperties(x, y, isTransparent, isWalkable);
+    transparent.set(x, y, isTransparent);
+    walkable.set(x, y, isWalkable);
+    version++;
+    record({x, y});
+  }
+  // The terrain as bit planes, for kernels that work a row at a time.
+  inline const BitPlane &walkableTiles() const { return walkable; }
+  inline const BitPlane &transparentTiles() const { return transparent; }
+  inline const BitPlane &exploredTiles() const { return explored; }
+  inline const BitPlane &waterTiles() const { return water; }
+  // How many times a tile's terrain, explored flag or items have changed on
+  // this floor. Readers keep it as their cursor into the journal.
+  inline size_t changeCount() const { return journalStart + journal.size(); }
+  // The tiles changed since cursor, oldest first. Only the latest changes are
+  // kept, so nothing comes back once the journal no longer reaches as far as
+  // cursor, and the reader has to start over.
+  using Changes = std::pair<std::vector<pathfinding::Index>::const_iterator,
+                            std::vector<pathfinding::Index>::const_iterator>;
+  inline std::optional<Changes> changesSince(size_t cursor) const {
+    if (cursor < journalStart || cursor > changeCount()) {
+      return std::nullopt;
+    }
+    return Changes{journal.begin() + (std::ptrdiff_t)(cursor - journalStart),
+                   journal.end()};
+  }
+  // The step from `from` that best gets away from the player, out of a
+  // safety map shared by every monster that moves the same way. Nothing when
+  // staying put is as safe as it gets.
+  std::optional<pathfinding::Index>
+  fleeStep(const Position &from, const Position &player, bool flying);
+  // A single path from `from` towards the player, found with A*. Like
+  // constructPath, it starts at `from` and stops short of the player.
+  std::vector<pathfinding::Index>
+  chasePlayer(const Position &from, const Position &player, bool flying) const;
+  // Every portal as {entrance, exit}, both ways round.
+  inline const std::vector<pathfinding::PortalPair> &portals() const {
+    return portalTable;
   }
+  inline std::optional<pathfinding::Index>
+  portalExit(std::array<int, 2> xy) const {
+    if (!inBounds(xy)) {
+      return std::nullopt;
+    }
+    auto slot = portalSlots[(size_t)(xy[1] * width + xy[0])];
+    if (slot < 0) {
+      return std::nullopt;
+    }
+    return portalTable[(size_t)slot][1];
+  }
+  void addPortal(std::array<int, 2> a, std::array<int, 2> b) {
+    addPortalEntry(a, b);
+    addPortalEntry(b, a);
+  }
+  // Rooms and the corridors between them, as left by the generator. Closed
+  // doors count as passable, so opening one doesn't invalidate it.
+  inline const pathfinding::RoomGraph &roomGraph() const { return graph; }
+  void buildRoomGraph(const std::vector<RectangularRoom> &rooms);
+  // Casts the sight of every monster that looks around for itself in one go,
+  // at the start of their turns.
+  void perceive(const std::vector<std::pair<flecs::entity, Viewer>> &viewers);
+  // What e sees from origin. The batch result when it still holds, cast on
+  // the spot otherwise.
+  const Visibility &sightOf(flecs::entity e, std::array<int, 2> origin,
+                            int radius);
+  // Scratch space for a search over this map, returned to the pool when the
+  // lease goes out of scope.
+  inline pathfinding::Lease borrowSearch() const { return searches->acquire(); }
   ScentType detectScent(flecs::entity e, std::array<int, 2> &strongest) const;
   std::string detectScent(flecs::entity e) const;
 
   static flecs::entity get_blocking_entity(flecs::entity map,
                                            const Position &pos);
 
+  // The map's children standing on tiles the player has line of sight to, in
+  // row order as of the last update_fov and kept in step as they move since.
+  // Whether they are lit enough to be seen is up to isVisible.
+  inline const std::vector<flecs::entity> &entitiesInView() const {
+    return inViewEntities;
+  }
+  // Lookups into the tile index of the map's children. The player isn't a
+  // child of the map, so it never shows up here.
+  inline const std::vector<flecs::entity> &
+  entitiesAt(std::array<int, 2> xy) const {
+    return spatial.at(xy);
+  }
+  template <typename T> flecs::entity entityAt(std::array<int, 2> xy) const {
+    for (auto &e : spatial.at(xy)) {
+      if (e.has<T>()) {
+        return e;
+      }
+    }
+    return flecs::entity{};
+  }
+  inline std::optional<std::array<int, 2>> indexedAt(flecs::entity e) const {
+    return spatial.locate(e);
+  }
+  // The moves out of xy for the searches over this map: the 8 neighbours
+  // that can be walked (or flown) onto, closed doors too if throughDoors, and
+  // the portal's exit. A closed door costs an extra turn to open.
+  pathfinding::Neighbours movesFrom(pathfinding::Index xy, bool flying,
+                                    bool throughDoors = false) const;
+  int moveCost(pathfinding::Index xy) const;
+  void index(flecs::entity e, std::array<int, 2> xy);
+  // The map's children that leave scent behind each turn.
+  void addScentSource(flecs::entity e);
+  void removeScentSource(flecs::entity e);
+  void moveIndexed(flecs::entity e, std::array<int, 2> xy);
+  void unindex(flecs::entity e);
+  // Rebuilds the tile index, the portal table and the scent sources from the
+  // map's children.
+  void reindex(flecs::entity mapEntity);
+
   int width;
   int height;
   int level;
   bool lit;
   std::vector<Tile> tiles;
-  std::vector<Scent> scent;
+  std::vector<TileScent> scent;
   std::vector<float> luminosity;
 
 private:
+  void addLight(flecs::entity mapEntity);
+  void invalidateLights(std::array<int, 2> xy);
+  void trackView(flecs::entity e, std::optional<std::array<int, 2>> xy);
+  void record(pathfinding::Index xy);
+  inline void addPortalEntry(std::array<int, 2> from, std::array<int, 2> to) {
+    auto &slot = portalSlots[(size_t)(from[1] * width + from[0])];
+    if (slot < 0) {
+      slot = (int)portalTable.size();
+      portalTable.push_back({from, to});
+    } else {
+      portalTable[(size_t)slot][1] = to;
+    }
+  }
+
   TCODMap map;
   TCODNoise noise;
+  uint64_t version = 0;
+  std::shared_ptr<pathfinding::Pool> searches;
+  std::array<PlayerField, 2> fleeFields; // Walking and Flying.
+  // The latest changes, from change number journalStart on. Past a tile's
+  // worth of entries, replaying them costs as much as starting over, so the
+  // older half is dropped.
+  std::vector<pathfinding::Index> journal;
+  size_t journalStart = 0;
+  SpatialIndex spatial;
+  pathfinding::RoomGraph graph;
+  std::vector<pathfinding::PortalPair> portalTable;
+  std::vector<int> portalSlots; // Into portalTable, by tile.
+  std::vector<uint8_t> inView; // 1 where the player has line of sight.
+  std::vector<flecs::entity> inViewEntities;
+  // {x1, y1, x2, y2} around everything in the player's view.
+  std::array<int, 4> fovBox = {0, 0, -1, -1};
+  static constexpr auto fovRadius = 8;
+#ifdef YARL_LOS_CACHE
+  static constexpr auto cacheLos = true;
+#else
+  static constexpr auto cacheLos = false;
+#endif
+  // The view from every tile at fovRadius, for the player and for monsters
+  // that look as far. It takes some 75 bytes a tile, close to 5 MB on a
+  // 256x256 floor, so it is only built with YARL_LOS_CACHE, on first use.
+  std::optional<LosCache> los;
+  std::unordered_map<flecs::entity_t, LightStamp> lightStamps;
+  // The lights summed into luminosity last time, in order. Empty until the
+  // first sum.
+  std::optional<std::vector<flecs::entity_t>> lightOrder;
+  struct Sight {
+    Viewer viewer;
+    uint64_t version;
+    Visibility visible;
+  };
+  const FovSnapshot &fovSnapshot();
+  // The floor's LosCache, built if need be, or nullptr when it is turned off.
+  LosCache *losCache();
+  Visibility cachedSight(LosCache &cache, std::array<int, 2> origin);
+  FovSnapshot snapshot;
+  uint64_t snapshotVersion = 0;
+  std::unordered_map<flecs::entity_t, Sight> sights;
+  // update_scent diffuses into this and then swaps it with scent.
+  std::vector<TileScent> backScent;
+  // Sorted by id. Deposits of different types on one tile don't commute, so
+  // they have to go in an order that doesn't depend on when each source
+  // turned up.
+  std::vector<flecs::entity> scentSources;
+  BitPlane walkable;
+  BitPlane transparent;
+  BitPlane explored;
+  BitPlane water;
+  ScentField scentField;
 };
 
 static inline TCOD_ConsoleTile lerp(const TCOD_ConsoleTile &x,
@@ -860,13 +860,13 @@ std::unique_ptr<Action> AutoMove::keyDown(Command cmd, flecs::world ecs) {
 void AutoMove::on_render(flecs::world ecs, tcod::Console &console) {
   auto map = ecs.lookup("currentMap").target<CurrentMap>();
   auto &gm = map.get<GameMap>();
-  auto q = ecs.query_builder<const Position, const Fighter, const Invisible *>()
-               .with(flecs::ChildOf, map)
-               .build();
   auto seen = false;
-  q.each([&](auto &p, auto &f, auto i) {
-    seen |= gm.isVisible(p) && f.isAlive() && (!i || i->paused);
-  });
+  for (auto &e : gm.entitiesInView()) {
+    auto f = e.try_get<Fighter>();
+    auto i = e.try_get<Invisible>();
+    seen |= f && f->isAlive() && (!i || i->paused) &&
+            gm.isVisible(e.get<Position>());
+  }
   MainHandler::on_render(ecs, console);
   if (seen) {
     make<MainGameInputHandler>(ecs);
@@ -877,63 +877,28 @@ void AutoExplore::on_render(flecs::world ecs, tcod::Console &console) {
   auto player = ecs.entity("player");
   auto pos = player.get<Position>();
   auto &gameMap = map.get<GameMap>();
-  auto dij = pathfinding::Dijkstra(
-      {gameMap.getWidth(), gameMap.getHeight()},
-      [&](auto xy) {
-        if (!gameMap.isExplored(xy))
-          return true;
-        if (map.world()
-                .query_builder<const Position>()
-                .with<Item>()
-                .with(flecs::ChildOf, map)
-                .build()
-                .find([&](auto p) { return p == xy; })) {
-          return true;
-        }
-        return false;
-      },
-      [&](auto &xy) {
-        auto ret = std::vector<pathfinding::Index>();
-        ret.reserve(9); // 8 directions plus a portal
-        for (auto &dir : directions) {
-          auto next = pathfinding::Index{xy[0] + dir[0], xy[1] + dir[1]};
-          if (gameMap.inBounds(next) &&
-              (gameMap.isWalkable(next) ||
-               (player.has<Flying>() && gameMap.isFlyable(next)))) {
-            ret.push_back(next);
-          } else if (map.world()
-                         .query_builder<const Position>()
-                         .with<Openable>()
-                         .with(flecs::ChildOf, map)
-                         .build()
-                         .find([next](auto &p) { return p == next; })) {
-            ret.push_back(next);
-          }
-        }
-        flecs::entity e = ecs.query_builder<const Position>()
-                              .with(ecs.component<Portal>(), flecs::Wildcard)
-                              .with(flecs::ChildOf, map)
-                              .build()
-                              .find([xy](auto &p) { return p == xy; });
-        if (e) {
-          ret.push_back(e.target<Portal>().get<Position>());
-        }
-        return ret;
-      },
-      [&](auto xy) {
-        if (ecs.query_builder<const Position>()
-                .with<Openable>()
-                .with(flecs::ChildOf, map)
-                .build()
-                .find([xy](auto &p) { return p == xy; })) {
-          if (!gameMap.isWalkable(xy)) {
-            return 2;
-          }
-        }
-        return 1;
-      });
-  dij.scan();
-  auto xy = dij.cameFrom[pos];
+  auto goal = [&](auto xy) {
+    if (!gameMap.isExplored(xy))
+      return true;
+    if (gameMap.entityAt<Item>(xy)) {
+      return true;
+    }
+    return false;
+  };
+  auto adjacent = [&](auto &xy) { return gameMap.movesFrom(xy, flying, true); };
+  auto cost = [&](auto xy) { return gameMap.moveCost(xy); };
+
+  auto changes = gameMap.changesSince(cursor);
+  if (!field || flying != player.has<Flying>() || !changes) {
+    flying = player.has<Flying>();
+    field.emplace(pathfinding::Index{gameMap.getWidth(), gameMap.getHeight()});
+    field->scan(goal, adjacent, cost);
+  } else if (changes->first != changes->second) {
+    field->update(changes->first, changes->second, goal, adjacent, cost);
+  }
+  cursor = gameMap.changeCount();
+
+  auto xy = field->cameFrom[pos];
   if (!gameMap.inBounds(xy)) {
     MainHandler::on_render(ecs, console);
     make<MainGameInputHandler>(ecs);
@@ -959,51 +924,102 @@ void AutoExplore::on_render(flecs::world ecs, tcod::Console &console) {
 
 PathFinder::PathFinder(flecs::entity map, std::array<int, 2> orig,
                        std::array<int, 2> dest, const InputHandler &handler)
-    : AutoMove(handler) {
+    : AutoMove(handler), map(map), dest(dest) {
+  plan(orig);
+}
+
+void PathFinder::plan(std::array<int, 2> orig) {
   auto &gameMap = map.get<GameMap>();
+  auto &graph = gameMap.roomGraph();
   auto ecs = map.world();
   auto player = ecs.lookup("player");
-  auto dij = pathfinding::Dijkstra(
+  // While refining a route, steps are kept inside the region of the next
+  // waypoint. -1 lets the search go anywhere.
+  auto region = -1;
+  auto canEnter = [&](const pathfinding::Index &xy) {
+    return gameMap.inBounds(xy) && gameMap.isExplored(xy) &&
+           (gameMap.isWalkable(xy) ||
+            (player.has<Flying>() && gameMap.isFlyable(xy)));
+  };
+  auto astar = pathfinding::AStar(
       {gameMap.getWidth(), gameMap.getHeight()},
       [=](auto xy) { return orig == xy; },
       [&](auto &xy) {
-        auto ret = std::vector<pathfinding::Index>();
-        ret.reserve(9); // 8 directions plus a portal
-        for (auto &dir : directions) {
-          auto next = pathfinding::Index{xy[0] + dir[0], xy[1] + dir[1]};
-          if (gameMap.inBounds(next) && gameMap.isExplored(next) &&
-              (gameMap.isWalkable(next) ||
-               (player.has<Flying>() && gameMap.isFlyable(next)))) {
+        // Only explored tiles, and no portals while held to a region.
+        auto ret = pathfinding::Neighbours();
+        auto exit = gameMap.portalExit(xy);
+        for (auto &next : gameMap.movesFrom(xy, player.has<Flying>())) {
+          if (exit && next == *exit) {
+            if (region < 0) {
+              ret.push_back(next);
+            }
+          } else if (gameMap.isExplored(next) &&
+                     (region < 0 || graph.regionOf(next) == region)) {
             ret.push_back(next);
           }
         }
-        flecs::entity e = ecs.query_builder<Position>()
-                              .with(ecs.component<Portal>(), flecs::Wildcard)
-                              .with(flecs::ChildOf, map)
-                              .build()
-                              .find([xy](auto &p) { return p == xy; });
-        if (e) {
-          ret.push_back(e.target<Portal>().get<Position>());
-        }
         return ret;
       },
-      [&](auto xy) {
-        if (ecs.query_builder<const Position>()
-                .with<Openable>()
-                .with(flecs::ChildOf, map)
-                .build()
-                .find([xy](auto &p) { return p == xy; })) {
-          if (!gameMap.isWalkable(xy)) {
-            return 2;
-          }
+      [&](auto xy) { return gameMap.moveCost(xy); },
+      gameMap.portals(), gameMap.borrowSearch());
+  cursor = gameMap.changeCount();
+
+  // Far away, plan over the rooms first so the tile searches stay small.
+  if (!graph.empty() && pathfinding::chebyshev(orig, dest) > longRange) {
+    auto waypoints = graph.route(
+        orig, dest, [&](auto xy) { return gameMap.isExplored(xy); });
+    auto segments = std::vector<std::vector<pathfinding::Index>>();
+    auto from = orig;
+    for (auto &to : waypoints) {
+      if (to == from) {
+        continue;
+      }
+      if (pathfinding::chebyshev(from, to) <= 1 ||
+          graph.regionOf(from) != graph.regionOf(to)) {
+        // A step across a boundary or through a portal.
+        if (!canEnter(to)) {
+          break;
         }
-        return 1;
-      });
-  dij.scan();
-  path = pathfinding::constructPath(orig, dest, dij.cameFrom);
+        segments.push_back({to});
+      } else {
+        region = graph.regionOf(to);
+        astar.scan(from, to);
+        segments.push_back(
+            pathfinding::constructPath(from, to, astar.cameFrom));
+        if (segments.back().empty()) {
+          break;
+        }
+      }
+      from = to;
+    }
+    if (!waypoints.empty() && from == dest) {
+      path.clear();
+      for (auto i = segments.rbegin(); i != segments.rend(); i++) {
+        path.insert(path.end(), i->begin(), i->end());
+      }
+      return;
+    }
+    region = -1;
+  }
+
+  astar.scan(orig, dest);
+  path = pathfinding::constructPath(orig, dest, astar.cameFrom);
 }
 
 void PathFinder::on_render(flecs::world ecs, tcod::Console &console) {
+  // Only replan when something changed on the rest of the route. Tiles
+  // explored elsewhere could give a shorter path, but not a broken one.
+  // When the journal doesn't go back far enough to tell, replan anyway.
+  auto &gameMap = map.get<GameMap>();
+  auto changes = gameMap.changesSince(cursor);
+  auto blocked =
+      !changes || std::any_of(changes->first, changes->second, [&](auto &xy) {
+        return std::find(path.begin(), path.end(), xy) != path.end();
+      });
+  cursor = gameMap.changeCount();
+  if (blocked) {
+    plan(ecs.entity("player").get<Position>());
+  }
   if (path.empty()) {
     MainHandler::on_render(ecs, console);
     make<MainGameInputHandler>(ecs);
@@ -8,6 +8,7 @@
 #include <cstdint>
 #include <functional>
 #include <memory>
+#include <optional>
 #include <string>
 #include <type_traits>
 
@@ -18,6 +19,7 @@
 #include "game_map.hpp"
 #include "inventory.hpp"
 #include "message_log.hpp"
+#include "pathfinding.hpp"
 
 struct InputHandler {
   virtual ~InputHandler() = default;
@@ -380,6 +382,12 @@ struct AutoExplore : AutoMove {
   virtual void on_render(flecs::world, tcod::Console &) override;
 
   flecs::entity map;
+  // Distance to the nearest unexplored tile or item. It is built on the first
+  // step and then repaired from the map's journal.
+  std::optional<pathfinding::IncrementalDijkstra<pathfinding::BucketQueue<2>>>
+      field;
+  size_t cursor = 0;
+  bool flying = false;
 };
 
 struct PathFinder : AutoMove {
@@ -389,6 +397,16 @@ struct PathFinder : AutoMove {
   virtual void on_render(flecs::world, tcod::Console &) override;
 
   std::vector<std::array<int, 2>> path;
+
+private:
+  void plan(std::array<int, 2> orig);
+
+  flecs::entity map;
+  std::array<int, 2> dest;
+  // How much of the map's journal the current path has seen.
+  size_t cursor;
+  // Beyond this distance, paths are planned over the map's room graph first.
+  static constexpr auto longRange = 24;
 };
 
 template <bool useRope> struct JumpConfirm : AskUserInputHandler {
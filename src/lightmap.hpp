@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "game_map.hpp"
+
+// The per-frame passes over luminosity and the tile flags. Each one is a
+// straight loop over contiguous arrays, without branches or calls, so the
+// compiler is free to vectorize it.
+
+// Adds n tiles' worth of lumens into luminosity, capping each at full light.
+inline void accumulateLight(float *luminosity, const float *lumens, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    auto l = luminosity[i] + lumens[i];
+    luminosity[i] = l < 1.0f ? l : 1.0f;
+  }
+}
+
+// Marks each of n tiles that is in view and lit as explored, and any blood
+// on it as known.
+inline void mergeVisible(Tile *tiles, const uint8_t *inView,
+                         const float *luminosity, size_t n) {
+  static_assert(Tile::KnownBloody == Tile::Bloody << 1);
+  for (size_t i = 0; i < n; i++) {
+    auto seen = (uint8_t)(inView[i] & (luminosity[i] > 0.0f));
+    auto flags = tiles[i].flags;
+    auto known = (uint8_t)((flags & Tile::Bloody) << 1);
+    tiles[i].flags = (uint8_t)(flags | ((Tile::Explored | known) * seen));
+  }
+}
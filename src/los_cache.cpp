@@ -0,0 +1,83 @@
+#include "los_cache.hpp"
+
+#include <algorithm>
+
+#include "fov.hpp"
+#include "game_map.hpp"
+#include "pathfinding.hpp"
+#include "thread_pool.hpp"
+
+LosCache::LosCache(int width, int height, int radius)
+    : width(width), height(height), radius(radius), reach(radius + 1),
+      side(2 * reach + 1), wordsPerEntry((size_t)(side * side + 63) / 64),
+      valid((size_t)(width * height), 0),
+      sawPortal((size_t)(width * height), 0),
+      window((size_t)(width * height) * wordsPerEntry, 0),
+      far((size_t)(width * height)) {}
+
+void LosCache::fill(const GameMap &map,
+                    const std::vector<std::array<int, 2>> &origins) {
+  auto todo = std::vector<size_t>();
+  for (auto &xy : origins) {
+    auto i = index(xy);
+    if (!valid[i] && std::find(todo.begin(), todo.end(), i) == todo.end()) {
+      todo.push_back(i);
+    }
+  }
+  ThreadPool::shared().parallelFor(todo.size(),
+                                   [&](size_t j) { cast(map, todo[j]); });
+  for (auto i : todo) {
+    settle(i);
+  }
+}
+
+void LosCache::invalidate(std::array<int, 2> xy) {
+  if (cached == 0) {
+    return;
+  }
+  auto drop = [this](size_t i) {
+    if (valid[i]) {
+      valid[i] = 0;
+      cached--;
+    }
+  };
+  for (auto y = std::max(xy[1] - reach, 0);
+       y <= std::min(xy[1] + reach, height - 1); y++) {
+    for (auto x = std::max(xy[0] - reach, 0);
+         x <= std::min(xy[0] + reach, width - 1); x++) {
+      drop(index({x, y}));
+    }
+  }
+  for (auto i : throughPortals) {
+    drop(i);
+  }
+  throughPortals.clear();
+}
+
+void LosCache::cast(const GameMap &map, size_t i) {
+  auto origin = std::array{(int)i % width, (int)i / width};
+  auto bits = window.data() + i * wordsPerEntry;
+  std::fill(bits, bits + wordsPerEntry, 0);
+  far[i].clear();
+  sawPortal[i] = 0;
+  computeFov(map, origin, radius, [&](auto xy, auto) {
+    if (pathfinding::chebyshev(xy, origin) <= reach) {
+      auto b = (size_t)((xy[1] - origin[1] + reach) * side + xy[0] -
+                        origin[0] + reach);
+      bits[b / 64] |= uint64_t(1) << (b % 64);
+    } else {
+      far[i].push_back(xy);
+    }
+    if (map.portalExit(xy)) {
+      sawPortal[i] = 1;
+    }
+  });
+}
+
+void LosCache::settle(size_t i) {
+  valid[i] = 1;
+  cached++;
+  if (sawPortal[i]) {
+    throughPortals.push_back(i);
+  }
+}
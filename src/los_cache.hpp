@@ -0,0 +1,77 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct GameMap;
+
+// What can be seen from each tile of a floor, out to a fixed radius. A tile's
+// view is cast the first time somebody looks from it and kept until the
+// transparency of a tile near it changes, which once the floor is generated
+// only happens when a door is opened or closed. Each tile takes a bit for
+// every tile of its window plus a list for what lies beyond, some 75 bytes at
+// radius 8.
+class LosCache {
+public:
+  LosCache(int width = 0, int height = 0, int radius = 0);
+
+  inline int getRadius() const { return radius; }
+  inline bool has(std::array<int, 2> origin) const {
+    return valid[index(origin)];
+  }
+
+  // f(xy) for every tile in view from origin, casting it first if need be.
+  template <typename F>
+  void forEach(const GameMap &map, std::array<int, 2> origin, F &&f) {
+    auto i = index(origin);
+    if (!valid[i]) {
+      cast(map, i);
+      settle(i);
+    }
+    auto bits = window.data() + i * wordsPerEntry;
+    for (auto b = 0; b < side * side; b++) {
+      if ((bits[b / 64] >> (b % 64)) & 1) {
+        f(std::array{origin[0] + b % side - reach,
+                     origin[1] + b / side - reach});
+      }
+    }
+    for (auto &xy : far[i]) {
+      f(xy);
+    }
+  }
+  // Casts every origin not yet in the cache, spread across the shared pool.
+  void fill(const GameMap &map, const std::vector<std::array<int, 2>> &origins);
+  // Drops every view that xy could have been part of. Call it whenever xy
+  // turns transparent or opaque.
+  void invalidate(std::array<int, 2> xy);
+
+private:
+  inline size_t index(std::array<int, 2> xy) const {
+    return (size_t)(xy[1] * width + xy[0]);
+  }
+  void cast(const GameMap &map, size_t i);
+  // Book-keeping after a cast, which has to happen off the pool.
+  void settle(size_t i);
+
+  int width;
+  int height;
+  int radius;
+  // A cast looks one row past its radius, so a view spans reach tiles each
+  // way.
+  int reach;
+  int side;
+  size_t wordsPerEntry;
+  std::vector<uint8_t> valid;
+  std::vector<uint8_t> sawPortal;
+  // The part of each view around its origin, a bit per tile of a side x side
+  // square centred on it.
+  std::vector<uint64_t> window;
+  // Tiles in view outside of the window, which only a portal can show.
+  std::vector<std::vector<std::array<int, 2>>> far;
+  // The cached views that looked through a portal. Any change can reach
+  // them.
+  std::vector<size_t> throughPortals;
+  size_t cached = 0;
+};
@@ -212,6 +212,7 @@ module::module(flecs::world ecs) {
   // engine.hpp
   ecs.component<Seed>().member<uint32_t>("seed");
   ecs.component<Turn>().member<int64_t>("turn");
+  ecs.component<SaveVersion>().member<int32_t>("version");
 
   // scent.hpp
   ecs.component<ScentType>();
@@ -222,6 +223,7 @@ module::module(flecs::world ecs) {
       .member("power", &ScentOnDeath::power)
       .is_a<OnDeath>();
   ecs.component<Smeller>().member<float>("threshold");
+  ecs.component<TileScent>().member<uint8_t>("type").member<int16_t>("power");
   ecs.component<ScentConsumable>()
       .member("scent", &ScentConsumable::scent)
       .is_a<Consumable>();
@@ -239,13 +241,58 @@ module::module(flecs::world ecs) {
   ecs.component<CurrentMap>().add(flecs::Exclusive);
   ecs.component<Tile>().member<uint8_t>("flags");
   ecs.component<std::vector<Tile>>().opaque(std_vector_support<Tile>);
-  ecs.component<std::vector<Scent>>().opaque(std_vector_support<Scent>);
+  ecs.component<std::vector<TileScent>>().opaque(
+      std_vector_support<TileScent>);
   ecs.component<GameMap>()
       .member<int>("width")
       .member<int>("height")
       .member<int>("level")
       .member<std::vector<Tile>>("tiles")
-      .member<std::vector<Scent>>("scent");
+      .member<std::vector<TileScent>>("scent");
+
+  // Keep each GameMap's tile index in step with its children. Moves that
+  // edit Position in place update the index themselves.
+  ecs.observer<const Position>("module::indexPosition")
+      .with(flecs::ChildOf, flecs::Wildcard)
+      .event(flecs::OnAdd)
+      .event(flecs::OnSet)
+      .event(flecs::OnRemove)
+      .each([](flecs::iter &it, size_t i, const Position &p) {
+        // Adding Position is always followed by an OnSet with its value.
+        if (it.event() == flecs::OnAdd && !it.event_id().is_pair()) {
+          return;
+        }
+        auto e = it.entity(i);
+        auto map = e.parent().try_get_mut<GameMap>();
+        if (map == nullptr) {
+          return;
+        }
+        if (it.event() == flecs::OnRemove) {
+          map->unindex(e);
+        } else {
+          map->index(e, p);
+        }
+      });
+  // And the list of children that leave scent behind.
+  ecs.observer<const Scent>("module::scentSources")
+      .with(flecs::ChildOf, flecs::Wildcard)
+      .event(flecs::OnSet)
+      .event(flecs::OnRemove)
+      .each([](flecs::iter &it, size_t i, const Scent &) {
+        auto e = it.entity(i);
+        auto map = e.parent().try_get_mut<GameMap>();
+        if (map == nullptr) {
+          return;
+        }
+        if (it.event() == flecs::OnRemove) {
+          map->removeScentSource(e);
+        } else {
+          map->addScentSource(e);
+        }
+      });
+  ecs.observer<GameMap>("module::indexMap")
+      .event(flecs::OnSet)
+      .each([](flecs::entity e, GameMap &map) { map.reindex(e); });
 
   // input_handler.hpp
   ecs.component<InputHandler>();
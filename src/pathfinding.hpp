@@ -1,11 +1,20 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <cassert>
 #include <climits>
 #include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
 #include <limits>
 #include <memory>
+#include <optional>
 #include <queue>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include <flecs.h>
@@ -49,8 +58,10 @@ private:
   std::unique_ptr<T[]> cost;
 };
 
+// M: anything with `Index operator[](Index) const`, such as CameFrom.
+template <typename M>
 inline std::vector<Index> constructPath(Index start, Index goal,
-                                        const map<Index> &cameFrom) {
+                                        const M &cameFrom) {
   auto path = std::vector<Index>{};
   auto current = goal;
   while (current != start) {
@@ -65,90 +76,360 @@ inline std::vector<Index> constructPath(Index start, Index goal,
 
 static constexpr auto Infinity = std::numeric_limits<int>::max();
 
+// The result of an adjacency callable: room for the 8 directions plus a
+// portal, without going to the heap.
+class Neighbours {
+public:
+  inline void push_back(const Index &xy) {
+    assert(count < data.size());
+    data[count++] = xy;
+  }
+  inline const Index *begin() const { return data.data(); }
+  inline const Index *end() const { return data.data() + count; }
+  inline size_t size() const { return count; }
+  inline bool empty() const { return count == 0; }
+
+private:
+  std::array<Index, 9> data;
+  size_t count = 0;
+};
+
+// Priority queues for the Dijkstra variants. Entries carry the distance they
+// were pushed with, so the scan can skip an entry whose tile has since been
+// reached more cheaply.
+
+// A binary heap. Works for any costs and seeds.
+class HeapQueue {
+public:
+  using Entry = std::pair<int, Index>;
+
+  inline void push(int d, const Index &xy) {
+    heap.push_back({d, xy});
+    std::push_heap(heap.begin(), heap.end(), std::greater<Entry>());
+  }
+  inline bool empty() const { return heap.empty(); }
+  inline Entry pop() {
+    std::pop_heap(heap.begin(), heap.end(), std::greater<Entry>());
+    auto ret = heap.back();
+    heap.pop_back();
+    return ret;
+  }
+  inline void clear() { heap.clear(); }
+
+private:
+  std::vector<Entry> heap;
+};
+
+// Dial's algorithm: a ring of MaxCost + 1 buckets, for integer costs in
+// [0, MaxCost]. Once the scan is running, every push lands within MaxCost of
+// the distance being popped. Seeds can hold any distance, so they are sorted
+// once and fed in as the scan reaches them.
+template <int MaxCost> class BucketQueue {
+public:
+  using Entry = std::pair<int, Index>;
+
+  inline void push(int d, const Index &xy) {
+    if (!started) {
+      seeds.push_back({d, xy});
+      return;
+    }
+    assert(current <= d && d <= current + MaxCost);
+    bucket(d).push_back(xy);
+    size++;
+  }
+  inline bool empty() const { return size == 0 && nextSeed == seeds.size(); }
+  Entry pop() {
+    assert(!empty());
+    if (!started) {
+      std::stable_sort(seeds.begin(), seeds.end(),
+                       [](const auto &lhs, const auto &rhs) {
+                         return lhs.first < rhs.first;
+                       });
+      started = true;
+      current = seeds[0].first;
+    }
+    while (true) {
+      for (; nextSeed < seeds.size() && seeds[nextSeed].first == current;
+           nextSeed++) {
+        bucket(current).push_back(seeds[nextSeed].second);
+        size++;
+      }
+      auto &b = bucket(current);
+      if (!b.empty()) {
+        auto xy = b.back();
+        b.pop_back();
+        size--;
+        return {current, xy};
+      }
+      current = size == 0 ? seeds[nextSeed].first : current + 1;
+    }
+  }
+  void clear() {
+    for (auto &b : buckets) {
+      b.clear();
+    }
+    seeds.clear();
+    nextSeed = 0;
+    size = 0;
+    started = false;
+  }
+
+private:
+  inline std::vector<Index> &bucket(int d) {
+    return buckets[(size_t)(((d % Size) + Size) % Size)];
+  }
+
+  static constexpr int Size = MaxCost + 1;
+  std::array<std::vector<Index>, Size> buckets;
+  std::vector<Entry> seeds;
+  size_t nextSeed = 0;
+  size_t size = 0;
+  int current = 0;
+  bool started = false;
+};
+
+// The per-tile state of one search, plus the queues it needs. Starting a new
+// search bumps the generation instead of clearing, and a tile whose stamp is
+// out of date reads as unreached.
+class Workspace {
+public:
+  struct Node {
+    int distance;
+    Index cameFrom;
+    uint32_t stamp;
+  };
+
+  void reset(Index dims) {
+    if (dims != dimensions) {
+      dimensions = dims;
+      nodes.assign((size_t)(dims[0] * dims[1]), {Infinity, {-1, -1}, 0});
+      generation = 0;
+    }
+    if (++generation == 0) {
+      for (auto &n : nodes) {
+        n.stamp = 0;
+      }
+      generation = 1;
+    }
+  }
+
+  inline int distance(const Index &xy) const {
+    auto &n = nodes[offset(xy)];
+    return n.stamp == generation ? n.distance : Infinity;
+  }
+  inline Index cameFrom(const Index &xy) const {
+    auto &n = nodes[offset(xy)];
+    return n.stamp == generation ? n.cameFrom : Index{-1, -1};
+  }
+  inline Node &at(const Index &xy) {
+    auto &n = nodes[offset(xy)];
+    if (n.stamp != generation) {
+      n = {Infinity, {-1, -1}, generation};
+    }
+    return n;
+  }
+
+  // f(xy, node) for every tile the current search has reached.
+  template <typename F> void forEachReached(F &&f) {
+    for (size_t i = 0; i < nodes.size(); i++) {
+      auto &n = nodes[i];
+      if (n.stamp == generation && n.distance != Infinity) {
+        f(Index{(int)i % dimensions[0], (int)i / dimensions[0]}, n);
+      }
+    }
+  }
+
+  template <typename Q> inline Q &queue() { return std::get<Q>(queues); }
+
+  // {f, g, tile} for AStar, kept as a heap.
+  std::vector<std::tuple<int, int, Index>> open;
+
+private:
+  inline size_t offset(const Index &xy) const {
+    assert(xy[0] >= 0);
+    assert(xy[1] >= 0);
+    return (size_t)(xy[0] + dimensions[0] * xy[1]);
+  }
+
+  Index dimensions = {0, 0};
+  std::vector<Node> nodes;
+  uint32_t generation = 0;
+  std::tuple<HeapQueue, BucketQueue<1>, BucketQueue<2>> queues;
+};
+
+class Pool;
+
+// A workspace borrowed from a Pool, handed back when the lease ends.
+class Lease {
+public:
+  Lease() = default;
+  Lease(std::shared_ptr<Pool> pool, std::unique_ptr<Workspace> workspace)
+      : pool(std::move(pool)), workspace(std::move(workspace)) {};
+  Lease(Lease &&) = default;
+  Lease &operator=(Lease &&other) {
+    release();
+    pool = std::move(other.pool);
+    workspace = std::move(other.workspace);
+    return *this;
+  }
+  ~Lease() { release(); }
+
+  inline Workspace *operator->() const { return workspace.get(); }
+  inline Workspace &operator*() const { return *workspace; }
+  inline Workspace *get() const { return workspace.get(); }
+  explicit operator bool() const { return workspace != nullptr; }
+
+  // Searches run without a pool get a workspace of their own.
+  static Lease orNew(Lease lease) {
+    if (!lease) {
+      lease.workspace = std::make_unique<Workspace>();
+    }
+    return lease;
+  }
+
+private:
+  inline void release();
+
+  std::shared_ptr<Pool> pool;
+  std::unique_ptr<Workspace> workspace;
+};
+
+class Pool : public std::enable_shared_from_this<Pool> {
+public:
+  Lease acquire() {
+    if (free.empty()) {
+      return {shared_from_this(), std::make_unique<Workspace>()};
+    }
+    auto ret = Lease(shared_from_this(), std::move(free.back()));
+    free.pop_back();
+    return ret;
+  }
+
+private:
+  friend class Lease;
+  std::vector<std::unique_ptr<Workspace>> free;
+};
+
+inline void Lease::release() {
+  if (pool && workspace) {
+    pool->free.push_back(std::move(workspace));
+  }
+  pool.reset();
+}
+
+// Read-only view of the predecessors in a workspace.
+class CameFrom {
+public:
+  CameFrom(const Workspace *workspace = nullptr) : workspace(workspace) {};
+  inline Index operator[](const Index &xy) const {
+    return workspace->cameFrom(xy);
+  }
+
+private:
+  const Workspace *workspace;
+};
+
 /******
  * F: std::function<bool(Index)>
  * G: std::function<RangedFor<Index>(Index)>
  * H: std::function<int(Index)>
+ * Q: HeapQueue, or BucketQueue<N> when every cost is at most N.
  * *****/
-template <typename F, typename G, typename H> class Dijkstra {
+template <typename F, typename G, typename H, typename Q = HeapQueue>
+class Dijkstra {
 public:
-  Dijkstra(Index dimensions, F start, G adjacent, H cost)
-      : dimensions(dimensions), distance(dimensions, Infinity),
-        cameFrom(dimensions, {-1, -1}), start(start), adjacent(adjacent),
-        cost(cost) {};
+  Dijkstra(Index dimensions, F start, G adjacent, H cost, Q = Q(),
+           Lease workspace = Lease())
+      : dimensions(dimensions),
+        workspace(Lease::orNew(std::move(workspace))),
+        cameFrom(this->workspace.get()), start(start), adjacent(adjacent),
+        cost(cost) {
+    this->workspace->reset(dimensions);
+  };
 
   Dijkstra &operator*=(float f) {
-    for (auto &d : distance) {
-      if (d != Infinity) {
-        d = (int)((float)d * f);
-      }
-    }
+    workspace->forEachReached(
+        [f](auto, auto &n) { n.distance = (int)((float)n.distance * f); });
     return *this;
   }
 
-  void scan(void) {
-    auto order = [&](const auto &lhs, const auto &rhs) {
-      return distance[lhs] > distance[rhs];
-    };
-    std::priority_queue<Index, std::vector<Index>, decltype(order)> queue(
-        order);
+  // With a non-empty stop set, the scan ends as soon as every tile in it has
+  // been settled. Only the settled part of the map is valid after that.
+  void scan(const std::vector<Index> &stop = {}) {
+    workspace->reset(dimensions);
+    auto &queue = workspace->queue<Q>();
+    queue.clear();
     for (auto y = 0; y < dimensions[1]; y++) {
       for (auto x = 0; x < dimensions[0]; x++) {
         if (start(Index{x, y})) {
-          distance[{x, y}] = 0;
-          queue.push({x, y});
-        } else {
-          distance[{x, y}] = Infinity;
+          workspace->at({x, y}).distance = 0;
+          queue.push(0, {x, y});
         }
       }
     }
 
-    scanPrivate(queue);
+    scanPrivate(stop);
   }
 
+  // Relaxes the map again, seeded from every reached tile at its current
+  // distance, as after `*=`. A tile nothing improves on is left without a
+  // cameFrom: no step from it does any better.
   void rescan(void) {
-    auto order = [&](const auto &lhs, const auto &rhs) {
-      return distance[lhs] > distance[rhs];
-    };
-    std::priority_queue<Index, std::vector<Index>, decltype(order)> queue(
-        order);
-    for (auto y = 0; y < dimensions[1]; y++) {
-      for (auto x = 0; x < dimensions[0]; x++) {
-        if (start(Index{x, y})) {
-          queue.push({x, y});
-        }
-      }
-    }
-
-    scanPrivate(queue);
+    auto &queue = workspace->queue<Q>();
+    queue.clear();
+    workspace->forEachReached([&queue](const Index &xy, auto &n) {
+      n.cameFrom = {-1, -1};
+      queue.push(n.distance, xy);
+    });
+
+    scanPrivate();
   }
 
+  // Hands the workspace, and so the results, to the caller. cameFrom must not
+  // be used afterwards.
+  Lease release() { return std::move(workspace); }
+
 private:
-  template <typename Q> inline void scanPrivate(Q &queue) {
+  inline void scanPrivate(const std::vector<Index> &stop = {}) {
+    auto &queue = workspace->queue<Q>();
+    auto settled = std::vector<bool>(stop.size(), false);
+    auto remaining = stop.size();
     while (!queue.empty()) {
-      auto next = queue.top();
-      queue.pop();
-      auto value = distance[next];
-      if (value == Infinity) {
+      auto [value, next] = queue.pop();
+      if (value != workspace->distance(next)) {
+        continue;
+      }
+      expanded++;
+
+      for (size_t i = 0; i < stop.size(); i++) {
+        if (!settled[i] && stop[i] == next) {
+          settled[i] = true;
+          remaining--;
+        }
+      }
+      if (stop.size() > 0 && remaining == 0) {
         return;
       }
 
       for (auto &v : adjacent(next)) {
         auto alt = value + cost(v);
-        if (alt < distance[v]) {
-          distance[v] = alt;
-          queue.push(v);
-          cameFrom[v] = next;
+        auto &n = workspace->at(v);
+        if (alt < n.distance) {
+          n.distance = alt;
+          n.cameFrom = next;
+          queue.push(alt, v);
         }
       }
     }
   }
 
   Index dimensions;
-  map<int> distance;
+  Lease workspace;
 
 public:
-  map<Index> cameFrom;
+  CameFrom cameFrom;
+  // Tiles taken off the queue, summed over every scan.
+  size_t expanded = 0;
 
 private:
   F start;
@@ -157,56 +438,217 @@ private:
 };
 
 /******
- * F: std::function<int(Index)>
  * G: std::function<RangedFor<Index>(Index)>
  * H: std::function<int(Index)>
+ * Q: HeapQueue, or BucketQueue<N> when every cost is at most N.
  * *****/
-template <typename G, typename H> class WanderDijkstra {
+template <typename G, typename H, typename Q = HeapQueue> class WanderDijkstra {
 public:
-  WanderDijkstra(Index dimensions, std::vector<int> start, G adjacent, H cost)
-      : dimensions(dimensions), distance(dimensions, Infinity),
-        cameFrom(dimensions, {-1, -1}), adjacent(adjacent), cost(cost) {
+  WanderDijkstra(Index dimensions, const std::vector<int> &start, G adjacent,
+                 H cost, Q = Q(), Lease workspace = Lease())
+      : dimensions(dimensions),
+        workspace(Lease::orNew(std::move(workspace))),
+        cameFrom(this->workspace.get()), adjacent(adjacent), cost(cost) {
+    this->workspace->reset(dimensions);
     for (auto y = 0; y < dimensions[1]; y++) {
       for (auto x = 0; x < dimensions[0]; x++) {
         auto v = start[y * dimensions[0] + x];
-        distance[{x, y}] = v == 0 ? Infinity : v;
+        if (v != 0) {
+          this->workspace->at({x, y}).distance = v;
+        }
       }
     }
   };
 
   void scan(void) {
-    auto order = [&](const auto &lhs, const auto &rhs) {
-      return distance[lhs] > distance[rhs];
-    };
-    std::priority_queue<Index, std::vector<Index>, decltype(order)> queue(
-        order);
+    auto &queue = workspace->queue<Q>();
+    queue.clear();
+    for (auto y = 0; y < dimensions[1]; y++) {
+      for (auto x = 0; x < dimensions[0]; x++) {
+        auto d = workspace->distance({x, y});
+        if (d != Infinity) {
+          queue.push(d, {x, y});
+        }
+      }
+    }
+
+    scanPrivate();
+  }
+
+private:
+  inline void scanPrivate() {
+    auto &queue = workspace->queue<Q>();
+    while (!queue.empty()) {
+      auto [value, next] = queue.pop();
+      if (value != workspace->distance(next)) {
+        continue;
+      }
+
+      for (auto &v : adjacent(next)) {
+        auto alt = value + cost(v);
+        auto &n = workspace->at(v);
+        if (alt < n.distance) {
+          n.distance = alt;
+          n.cameFrom = next;
+          queue.push(alt, v);
+        }
+      }
+    }
+  }
+
+  Index dimensions;
+  Lease workspace;
+
+public:
+  CameFrom cameFrom;
+
+private:
+  G adjacent;
+  H cost;
+};
+
+/******
+ * A multi-source distance field that can be repaired after local changes
+ * instead of being rebuilt. It only holds state. The callables are passed to
+ * every call and mean the same as for Dijkstra:
+ * F: std::function<bool(Index)>, the goal test. Or std::function<int(Index)>
+ *    giving each source its own starting distance, Infinity for none.
+ * G: std::function<RangedFor<Index>(Index)>
+ * H: std::function<int(Index)>
+ * Q: HeapQueue, or BucketQueue<N> when every cost is at most N.
+ * *****/
+template <typename Q = HeapQueue> class IncrementalDijkstra {
+public:
+  IncrementalDijkstra(Index dimensions = {0, 0}, Q = Q())
+      : dimensions(dimensions), distance(dimensions, Infinity),
+        cameFrom(dimensions, {-1, -1}),
+        marked((size_t)(dimensions[0] * dimensions[1]), false) {};
+
+  template <typename F, typename G, typename H>
+  void scan(F goal, G adjacent, H cost) {
+    queue.clear();
     for (auto y = 0; y < dimensions[1]; y++) {
       for (auto x = 0; x < dimensions[0]; x++) {
+        cameFrom[{x, y}] = {-1, -1};
+        distance[{x, y}] = seed(goal, Index{x, y});
         if (distance[{x, y}] != Infinity) {
-          queue.push({x, y});
+          queue.push(distance[{x, y}], {x, y});
         }
       }
     }
+    propagate(adjacent, cost);
+  }
+
+  // [first, last) lists every tile whose goal status, cost or neighbours may
+  // have changed since the last call. Tiles can repeat.
+  template <typename It, typename F, typename G, typename H>
+  void update(It first, It last, F goal, G adjacent, H cost) {
+    // Anything whose route to a goal ran through a changed tile has to be
+    // worked out again.
+    for (; first != last; ++first) {
+      mark(*first);
+    }
+    for (size_t i = 0; i < invalid.size(); i++) {
+      auto u = invalid[i];
+      forEachCandidate(u, adjacent, [&](const Index &v) {
+        if (cameFrom[v] == u) {
+          mark(v);
+        }
+      });
+    }
+    for (auto &u : invalid) {
+      distance[u] = Infinity;
+      cameFrom[u] = {-1, -1};
+    }
 
-    scanPrivate(queue);
+    // Reseed them from goals and from the still valid tiles around them, then
+    // let the ordinary scan settle the rest.
+    queue.clear();
+    for (auto &u : invalid) {
+      distance[u] = seed(goal, u);
+      forEachCandidate(u, adjacent, [&](const Index &p) {
+        if (distance[p] == Infinity) {
+          return;
+        }
+        for (auto &v : adjacent(p)) {
+          if (v == u) {
+            auto alt = distance[p] + cost(u);
+            if (alt < distance[u]) {
+              distance[u] = alt;
+              cameFrom[u] = p;
+            }
+            return;
+          }
+        }
+      });
+      if (distance[u] != Infinity) {
+        queue.push(distance[u], u);
+      }
+    }
+    for (auto &u : invalid) {
+      marked[offset(u)] = false;
+    }
+    invalid.clear();
+    propagate(adjacent, cost);
   }
 
+  inline Index getDimensions() const { return dimensions; }
+
 private:
-  template <typename Q> inline void scanPrivate(Q &queue) {
+  inline bool inBounds(const Index &xy) const {
+    return 0 <= xy[0] && xy[0] < dimensions[0] && 0 <= xy[1] &&
+           xy[1] < dimensions[1];
+  }
+  inline size_t offset(const Index &xy) const {
+    return (size_t)(xy[0] + dimensions[0] * xy[1]);
+  }
+  template <typename F> static inline int seed(F &goal, const Index &xy) {
+    if constexpr (std::is_same_v<decltype(goal(xy)), bool>) {
+      return goal(xy) ? 0 : Infinity;
+    } else {
+      return goal(xy);
+    }
+  }
+  inline void mark(const Index &xy) {
+    if (inBounds(xy) && !marked[offset(xy)]) {
+      marked[offset(xy)] = true;
+      invalid.push_back(xy);
+    }
+  }
+
+  // The tiles that can be on the other end of an edge from xy: its 8
+  // neighbours plus anything else adjacent reports, i.e. portals.
+  template <typename G, typename K>
+  inline void forEachCandidate(const Index &xy, G &adjacent, K &&k) {
+    for (auto dy = -1; dy <= 1; dy++) {
+      for (auto dx = -1; dx <= 1; dx++) {
+        auto v = Index{xy[0] + dx, xy[1] + dy};
+        if ((dx != 0 || dy != 0) && inBounds(v)) {
+          k(v);
+        }
+      }
+    }
+    for (auto &v : adjacent(xy)) {
+      if (std::max(std::abs(v[0] - xy[0]), std::abs(v[1] - xy[1])) > 1) {
+        k(v);
+      }
+    }
+  }
+
+  template <typename G, typename H> void propagate(G &adjacent, H &cost) {
     while (!queue.empty()) {
-      auto next = queue.top();
-      queue.pop();
-      auto value = distance[next];
-      if (value == Infinity) {
-        return;
+      auto [value, next] = queue.pop();
+      if (value != distance[next]) {
+        continue;
       }
+      expanded++;
 
       for (auto &v : adjacent(next)) {
         auto alt = value + cost(v);
         if (alt < distance[v]) {
           distance[v] = alt;
-          queue.push(v);
           cameFrom[v] = next;
+          queue.push(alt, v);
         }
       }
     }
@@ -217,13 +659,138 @@ private:
 
 public:
   map<Index> cameFrom;
+  // Tiles taken off the queue, summed over every scan and update.
+  size_t expanded = 0;
+
+private:
+  std::vector<bool> marked;
+  std::vector<Index> invalid;
+  Q queue;
+};
+
+inline int chebyshev(const Index &lhs, const Index &rhs) {
+  return std::max(std::abs(lhs[0] - rhs[0]), std::abs(lhs[1] - rhs[1]));
+}
+
+// A portal as {entrance, exit}. Symmetric portals are listed both ways.
+using PortalPair = std::array<Index, 2>;
+
+/******
+ * F: std::function<bool(Index)>
+ * G: std::function<RangedFor<Index>(Index)>
+ * H: std::function<int(Index)>
+ *
+ * Every step costs at least 1, so Chebyshev distance is admissible on its own.
+ * Portals break that, so the heuristic also considers walking to a portal,
+ * stepping through and continuing from its exit. The bound on each exit is
+ * itself relaxed over the other portals, so chains of portals stay admissible:
+ * https://stackoverflow.com/questions/14428331/
+ * *****/
+template <typename F, typename G, typename H> class AStar {
+public:
+  AStar(Index dimensions, F start, G adjacent, H cost,
+        std::vector<PortalPair> portals = {}, Lease workspace = Lease())
+      : dimensions(dimensions),
+        workspace(Lease::orNew(std::move(workspace))),
+        cameFrom(this->workspace.get()), start(start), adjacent(adjacent),
+        cost(cost), portals(std::move(portals)) {
+    this->workspace->reset(dimensions);
+  };
+
+  // Returns whether goal was reached. Only the tiles settled on the way are
+  // valid in cameFrom.
+  bool scan(Index goal) { return search(goal, std::nullopt); }
+
+  // Searches from `from` alone, without asking start about every tile.
+  bool scan(Index from, Index goal) { return search(goal, from); }
 
 private:
+  bool search(Index goal, std::optional<Index> from) {
+    workspace->reset(dimensions);
+    auto exitBounds = std::vector<int>(portals.size());
+    for (size_t i = 0; i < portals.size(); i++) {
+      exitBounds[i] = chebyshev(portals[i][1], goal);
+    }
+    for (auto changed = true; changed;) {
+      changed = false;
+      for (size_t i = 0; i < portals.size(); i++) {
+        for (size_t j = 0; j < portals.size(); j++) {
+          auto alt =
+              chebyshev(portals[i][1], portals[j][0]) + 1 + exitBounds[j];
+          if (alt < exitBounds[i]) {
+            exitBounds[i] = alt;
+            changed = true;
+          }
+        }
+      }
+    }
+    auto heuristic = [&](const Index &xy) {
+      auto h = chebyshev(xy, goal);
+      for (size_t i = 0; i < portals.size(); i++) {
+        h = std::min(h, chebyshev(xy, portals[i][0]) + 1 + exitBounds[i]);
+      }
+      return h;
+    };
+
+    // {f, g, tile}, so stale entries can be recognised by their g.
+    using Entry = std::tuple<int, int, Index>;
+    auto &open = workspace->open;
+    auto push = [&open](Entry e) {
+      open.push_back(e);
+      std::push_heap(open.begin(), open.end(), std::greater<Entry>());
+    };
+    open.clear();
+    if (from) {
+      workspace->at(*from).distance = 0;
+      push({heuristic(*from), 0, *from});
+    } else {
+      for (auto y = 0; y < dimensions[1]; y++) {
+        for (auto x = 0; x < dimensions[0]; x++) {
+          if (start(Index{x, y})) {
+            workspace->at({x, y}).distance = 0;
+            push({heuristic({x, y}), 0, {x, y}});
+          }
+        }
+      }
+    }
+
+    while (!open.empty()) {
+      std::pop_heap(open.begin(), open.end(), std::greater<Entry>());
+      auto [f, value, next] = open.back();
+      open.pop_back();
+      if (value != workspace->distance(next)) {
+        continue;
+      }
+      expanded++;
+      if (next == goal) {
+        return true;
+      }
+
+      for (auto &v : adjacent(next)) {
+        auto alt = value + cost(v);
+        auto &n = workspace->at(v);
+        if (alt < n.distance) {
+          n.distance = alt;
+          n.cameFrom = next;
+          push({alt + heuristic(v), alt, v});
+        }
+      }
+    }
+    return false;
+  }
+
+  Index dimensions;
+  Lease workspace;
+
+public:
+  CameFrom cameFrom;
+  size_t expanded = 0;
+
+private:
+  F start;
   G adjacent;
   H cost;
+  std::vector<PortalPair> portals;
 };
 
-// If we decide we need A* with portals, this has an admissable heuristic:
-// https://stackoverflow.com/questions/14428331/
-
 } // namespace pathfinding
@@ -99,17 +99,25 @@ std::optional<RectangularRoom> addRoom(const Config &cfg, int width, int height,
   auto edges = std::vector<std::array<int, 2>>();
   edges.reserve(height * width);
 
-  for (auto x = 0; x < width; x++) {
-    for (auto y = 0; y < height; y++) {
-      if (!map.isWalkable(x, y)) {
-        if (map.isWalkable(x - dir[0], y - dir[1])) {
-          if (!map.isWalkable(x + dir[0], y + dir[1])) {
-            edges.push_back({x, y});
-          }
+  // A wall with floor behind it and no floor ahead, 64 tiles at a time.
+  auto &walkable = map.walkableTiles();
+  for (auto y = 0; y < height; y++) {
+    for (auto x = 0; x < width; x += 64) {
+      auto bits = ~walkable.bits(x, y) &
+                  walkable.bits(x - dir[0], y - dir[1]) &
+                  ~walkable.bits(x + dir[0], y + dir[1]) & walkable.mask(x);
+      for (auto b = 0; bits != 0; b++, bits >>= 1) {
+        if (bits & 1) {
+          edges.push_back({x + b, y});
         }
       }
     }
   }
+  // The rng picks by index, so keep the column-major order the same seed has
+  // always produced.
+  std::stable_sort(edges.begin(), edges.end(), [](auto &lhs, auto &rhs) {
+    return lhs[0] < rhs[0];
+  });
 
   auto edge = edges[rng.getInt(0, (int)edges.size() - 1)];
   auto corridor_length = 1;
@@ -223,8 +231,7 @@ static void addLoops(const Config &cfg, int width, int height, GameMap &map,
           {map.getWidth(), map.getHeight()},
           [=](auto xy) { return xy[0] == x1 && xy[1] == y1; },
           [&](auto &xy) {
-            auto ret = std::vector<pathfinding::Index>();
-            ret.reserve(8);
+            auto ret = pathfinding::Neighbours();
             for (auto &dir : directions) {
               auto next = pathfinding::Index{xy[0] + dir[0], xy[1] + dir[1]};
               if (map.inBounds(next) && map.isWalkable(next)) {
@@ -233,8 +240,9 @@ static void addLoops(const Config &cfg, int width, int height, GameMap &map,
             }
             return ret;
           },
-          [&](auto) { return 1; });
-      dij.scan();
+          [&](auto) { return 1; }, pathfinding::BucketQueue<1>(),
+          map.borrowSearch());
+      dij.scan({{x2, y2}});
 
       auto path = pathfinding::constructPath({x1, y1}, {x2, y2}, dij.cameFrom);
       if (path.size() > cfg.MIN_LOOP_DISTANCE) {
@@ -387,7 +395,7 @@ static void addLake(const Config &cfg, int width, int height, TCODRandom &rng,
 
   if (water) {
     for (auto &xy : best.tiles) {
-      map.tiles[xy[1] * width + xy[0]].flags = Tile::Water;
+      map.makeWater(xy);
     }
   }
 }
@@ -573,6 +581,7 @@ static void addPortals(const Config &cfg, flecs::entity map, GameMap &dungeon,
         break;
       }
     }
+    dungeon.addPortal(e1.get<Position>(), e2.get<Position>());
   }
 }
 
@@ -601,6 +610,7 @@ void roomAccretion::generateDungeon(const Config &cfg, flecs::entity map,
   auto stairs = generateStairs(rooms, dungeon);
 
   if (!generateEntities) {
+    dungeon.buildRoomGraph(rooms);
     return;
   }
 
@@ -648,41 +658,15 @@ void roomAccretion::generateDungeon(const Config &cfg, flecs::entity map,
     }
   }
 
+  dungeon.reindex(map);
+  dungeon.buildRoomGraph(rooms);
   auto pos = player.get<Position>();
   auto dij = pathfinding::Dijkstra(
       {dungeon.getWidth(), dungeon.getHeight()},
       [=](auto xy) { return pos == xy || stairs == xy; },
-      [&](auto &xy) {
-        auto ret = std::vector<pathfinding::Index>();
-        ret.reserve(9); // 8 directions plus a portal
-        for (auto &dir : directions) {
-          auto next = pathfinding::Index{xy[0] + dir[0], xy[1] + dir[1]};
-          if (dungeon.inBounds(next) && dungeon.isWalkable(next)) {
-            ret.push_back(next);
-          }
-        }
-        flecs::entity e = ecs.query_builder<Position>()
-                              .with(ecs.component<Portal>(), flecs::Wildcard)
-                              .with(flecs::ChildOf, map)
-                              .build()
-                              .find([xy](auto &p) { return p == xy; });
-        if (e) {
-          ret.push_back(e.target<Portal>().get<Position>());
-        }
-        return ret;
-      },
-      [&](auto xy) {
-        if (ecs.query_builder<const Position>()
-                .with<Openable>()
-                .with(flecs::ChildOf, map)
-                .build()
-                .find([xy](auto &p) { return p == xy; })) {
-          if (!dungeon.isWalkable(xy)) {
-            return 2;
-          }
-        }
-        return 1;
-      });
+      [&](auto &xy) { return dungeon.movesFrom(xy, false); },
+      [&](auto xy) { return dungeon.moveCost(xy); },
+      pathfinding::BucketQueue<2>(), dungeon.borrowSearch());
 
   dij.scan();
 }
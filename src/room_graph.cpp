@@ -0,0 +1,226 @@
+#include "room_graph.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <utility>
+
+#include "defines.hpp"
+
+namespace pathfinding {
+
+RoomGraph::RoomGraph(Index dimensions, const std::vector<int> &roomOf,
+                     const std::vector<int> &cost,
+                     const std::vector<PortalPair> &portals)
+    : dimensions(dimensions), region(cost.size(), -1), cost(cost) {
+  const auto width = dimensions[0];
+  auto idx = [width](const Index &xy) {
+    return (size_t)(xy[1] * width + xy[0]);
+  };
+  auto inBounds = [&dimensions](const Index &xy) {
+    return 0 <= xy[0] && xy[0] < dimensions[0] && 0 <= xy[1] &&
+           xy[1] < dimensions[1];
+  };
+
+  // Flood fill the passable tiles into regions that don't straddle a room
+  // boundary.
+  auto stack = std::vector<Index>();
+  for (auto y = 0; y < dimensions[1]; y++) {
+    for (auto x = 0; x < dimensions[0]; x++) {
+      if (cost[idx({x, y})] == 0 || region[idx({x, y})] >= 0) {
+        continue;
+      }
+      auto r = (int)bounds.size();
+      auto room = roomOf[idx({x, y})];
+      bounds.push_back({x, y, x, y});
+      region[idx({x, y})] = r;
+      stack.push_back({x, y});
+      while (!stack.empty()) {
+        auto xy = stack.back();
+        stack.pop_back();
+        auto &b = bounds.back();
+        b = {std::min(b.x1, xy[0]), std::min(b.y1, xy[1]),
+             std::max(b.x2, xy[0]), std::max(b.y2, xy[1])};
+        for (auto &dir : directions) {
+          auto next = Index{xy[0] + dir[0], xy[1] + dir[1]};
+          if (inBounds(next) && cost[idx(next)] > 0 &&
+              region[idx(next)] < 0 && roomOf[idx(next)] == room) {
+            region[idx(next)] = r;
+            stack.push_back(next);
+          }
+        }
+      }
+    }
+  }
+
+  auto nodeOf = std::vector<int>(cost.size(), -1);
+  auto addNode = [&](const Index &xy) {
+    auto &n = nodeOf[idx(xy)];
+    if (n < 0) {
+      n = (int)nodes.size();
+      nodes.push_back(xy);
+    }
+  };
+  for (auto y = 0; y < dimensions[1]; y++) {
+    for (auto x = 0; x < dimensions[0]; x++) {
+      auto r = region[idx({x, y})];
+      if (r < 0) {
+        continue;
+      }
+      for (auto &dir : directions) {
+        auto next = Index{x + dir[0], y + dir[1]};
+        if (inBounds(next) && region[idx(next)] >= 0 &&
+            region[idx(next)] != r) {
+          addNode({x, y});
+          break;
+        }
+      }
+    }
+  }
+  for (auto &p : portals) {
+    if (region[idx(p[0])] >= 0 && region[idx(p[1])] >= 0) {
+      addNode(p[0]);
+      addNode(p[1]);
+    }
+  }
+
+  edges.resize(nodes.size());
+  entrances.resize(bounds.size());
+  for (size_t n = 0; n < nodes.size(); n++) {
+    const auto &xy = nodes[n];
+    auto r = region[idx(xy)];
+    entrances[(size_t)r].push_back((int)n);
+    for (auto &dir : directions) {
+      auto next = Index{xy[0] + dir[0], xy[1] + dir[1]};
+      if (inBounds(next) && region[idx(next)] >= 0 &&
+          region[idx(next)] != r) {
+        edges[n].push_back({nodeOf[idx(next)], cost[idx(next)]});
+      }
+    }
+  }
+  for (auto &p : portals) {
+    // An entrance can be a node on a region boundary while its exit is on a
+    // tile outside every region, with no node of its own.
+    auto from = nodeOf[idx(p[0])];
+    auto to = nodeOf[idx(p[1])];
+    if (from >= 0 && to >= 0) {
+      edges[(size_t)from].push_back({to, cost[idx(p[1])]});
+    }
+  }
+
+  // Within a region, every entrance is joined to every other one it can
+  // reach, at the cost of the shortest path between them.
+  for (size_t r = 0; r < entrances.size(); r++) {
+    for (auto a : entrances[r]) {
+      auto distances = distancesWithin((int)r, nodes[(size_t)a]);
+      for (auto b : entrances[r]) {
+        auto d = distances[offset((int)r, nodes[(size_t)b])];
+        if (a != b && d != Infinity) {
+          edges[(size_t)a].push_back({b, d});
+        }
+      }
+    }
+  }
+}
+
+std::vector<int> RoomGraph::distancesWithin(int r, Index from) const {
+  const auto &b = bounds[(size_t)r];
+  auto distances =
+      std::vector<int>((size_t)((b.x2 - b.x1 + 1) * (b.y2 - b.y1 + 1)),
+                       Infinity);
+  using Entry = std::pair<int, Index>;
+  auto open =
+      std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>>();
+  distances[offset(r, from)] = 0;
+  open.push({0, from});
+  while (!open.empty()) {
+    auto [d, xy] = open.top();
+    open.pop();
+    if (d > distances[offset(r, xy)]) {
+      continue;
+    }
+    for (auto &dir : directions) {
+      auto next = Index{xy[0] + dir[0], xy[1] + dir[1]};
+      if (regionOf(next) != r) {
+        continue;
+      }
+      auto alt = d + cost[(size_t)(next[1] * dimensions[0] + next[0])];
+      auto &current = distances[offset(r, next)];
+      if (alt < current) {
+        current = alt;
+        open.push({alt, next});
+      }
+    }
+  }
+  return distances;
+}
+
+std::vector<Index>
+RoomGraph::route(Index from, Index to,
+                 const std::function<bool(Index)> &usable) const {
+  auto rs = regionOf(from);
+  auto rg = regionOf(to);
+  if (rs < 0 || rg < 0) {
+    return {};
+  }
+  if (rs == rg) {
+    return {to};
+  }
+
+  auto fromStart = distancesWithin(rs, from);
+  auto toGoal = distancesWithin(rg, to);
+
+  auto distance = std::vector<int>(nodes.size(), Infinity);
+  auto cameFrom = std::vector<int>(nodes.size(), -1);
+  using Entry = std::pair<int, int>;
+  auto open =
+      std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>>();
+  for (auto n : entrances[(size_t)rs]) {
+    auto d = fromStart[offset(rs, nodes[(size_t)n])];
+    if (d != Infinity && usable(nodes[(size_t)n])) {
+      distance[(size_t)n] = d;
+      open.push({d, n});
+    }
+  }
+
+  auto best = Infinity;
+  auto last = -1;
+  while (!open.empty()) {
+    auto [d, n] = open.top();
+    open.pop();
+    if (d >= best) {
+      break;
+    }
+    if (d > distance[(size_t)n]) {
+      continue;
+    }
+    const auto &xy = nodes[(size_t)n];
+    if (regionOf(xy) == rg) {
+      auto remaining = toGoal[offset(rg, xy)];
+      if (remaining != Infinity && d + remaining < best) {
+        best = d + remaining;
+        last = n;
+      }
+    }
+    for (auto &e : edges[(size_t)n]) {
+      auto alt = d + e.cost;
+      if (alt < distance[(size_t)e.to] && usable(nodes[(size_t)e.to])) {
+        distance[(size_t)e.to] = alt;
+        cameFrom[(size_t)e.to] = n;
+        open.push({alt, e.to});
+      }
+    }
+  }
+  if (last < 0) {
+    return {};
+  }
+
+  auto ret = std::vector<Index>{to};
+  for (auto n = last; n >= 0; n = cameFrom[(size_t)n]) {
+    ret.push_back(nodes[(size_t)n]);
+  }
+  std::reverse(ret.begin(), ret.end());
+  return ret;
+}
+
+} // namespace pathfinding
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include <vector>
+
+#include "pathfinding.hpp"
+
+namespace pathfinding {
+
+// An abstract graph of a generated level, for routes that cross many rooms.
+// The passable tiles are split into regions (a room, or a run of corridor
+// between rooms), and the nodes are the tiles where one region meets another
+// or a portal leaves. A route is planned over the nodes first and only then
+// refined into tiles, one region at a time.
+class RoomGraph {
+public:
+  RoomGraph() = default;
+  // roomOf names the room each tile belongs to, or -1 outside of every room.
+  // cost is the price of stepping onto a tile, 0 where it can't be entered.
+  RoomGraph(Index dimensions, const std::vector<int> &roomOf,
+            const std::vector<int> &cost,
+            const std::vector<PortalPair> &portals);
+
+  inline bool empty() const { return nodes.empty(); }
+  inline int regionOf(Index xy) const {
+    if (xy[0] < 0 || xy[0] >= dimensions[0] || xy[1] < 0 ||
+        xy[1] >= dimensions[1]) {
+      return -1;
+    }
+    return region[(size_t)(xy[1] * dimensions[0] + xy[0])];
+  }
+
+  // Waypoints from `from` (excluded) to `to` (included). Two consecutive
+  // waypoints are either a single step apart or in the same region. Nodes
+  // that fail `usable` are left out. Empty if there is no route.
+  std::vector<Index> route(Index from, Index to,
+                           const std::function<bool(Index)> &usable) const;
+
+private:
+  struct Edge {
+    int to;
+    int cost;
+  };
+  struct Bounds {
+    int x1;
+    int y1;
+    int x2;
+    int y2;
+  };
+
+  // Distances from `from` to every tile of its region, indexed within the
+  // region's bounds.
+  std::vector<int> distancesWithin(int r, Index from) const;
+  inline size_t offset(int r, Index xy) const {
+    const auto &b = bounds[(size_t)r];
+    return (size_t)((xy[1] - b.y1) * (b.x2 - b.x1 + 1) + xy[0] - b.x1);
+  }
+
+  Index dimensions = {0, 0};
+  std::vector<int> region;
+  std::vector<int> cost;
+  std::vector<Bounds> bounds;
+  std::vector<Index> nodes;
+  std::vector<std::vector<Edge>> edges;
+  std::vector<std::vector<int>> entrances; // Node ids of each region.
+};
+
+} // namespace pathfinding
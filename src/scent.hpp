@@ -2,6 +2,9 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
 #include <string>
 
 #include "actor.hpp"
@@ -49,6 +52,41 @@ struct Scent {
   };
 };
 
+// Scent as the map keeps it, with power in fixed point: each step of power is
+// a quarter of a Scent's power (one = 4 steps to the unit), so the int16_t
+// holds -8192 to just under 8192. Tiles diffuse by integer arithmetic, so they
+// come out the same whichever way the map is worked, and take half the room of
+// a Scent.
+struct TileScent {
+  static constexpr auto one = 4;
+
+  uint8_t type = 0;
+  int16_t power = 0;
+
+  TileScent() = default;
+  TileScent(uint8_t type, int16_t power) : type(type), power(power){};
+  TileScent(const Scent &s) : type((uint8_t)s.type), power(fixed(s.power)){};
+
+  inline ScentType kind() const { return (ScentType)type; }
+  inline float strength() const { return (float)power / one; }
+  inline Scent toScent() const { return {kind(), strength()}; }
+
+  // The same rule as Scent's, rounded back to the nearest step.
+  TileScent &operator+=(const Scent &rhs) {
+    auto s = toScent();
+    s += rhs;
+    return *this = s;
+  };
+
+  // power in steps of 1 / one, as near as int16_t gets.
+  static int16_t fixed(float power) {
+    using Limits = std::numeric_limits<int16_t>;
+    auto steps =
+        std::clamp(power * one, (float)Limits::min(), (float)Limits::max());
+    return (int16_t)std::lround(steps);
+  }
+};
+
 struct ScentWarning {
   bool warned;
 };
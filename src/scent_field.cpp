@@ -0,0 +1,204 @@
+#include "scent_field.hpp"
+
+#include <algorithm>
+
+#include "defines.hpp"
+
+ScentField::ScentField(int width, int height)
+    : width(width), height(height), stride(width + 2),
+      inActive((size_t)(width * height), 0) {
+  auto paddedSize = (size_t)((width + 2) * (height + 2));
+  for (size_t k = 1; k < types; k++) {
+    power[k].assign(paddedSize, 0);
+    count[k].assign(paddedSize, 0);
+    level[k].assign((size_t)(width * height), 0);
+    carriers[k].assign((size_t)(width * height), 0);
+  }
+}
+
+// out[x] = in[x] plus its eight neighbours.
+static void stencil(const int32_t *in, int stride, int32_t *out, int n) {
+  for (auto x = 0; x < n; x++) {
+    auto acc = in[x];
+    for (auto &d : directions) {
+      acc += in[x + d[1] * stride + d[0]];
+    }
+    out[x] = acc;
+  }
+}
+
+// What a tile becomes, given the power on and around it of each type and how
+// many tiles carry it. The first type with the most power wins, as with
+// max_element, and none wins only while no type has any.
+template <typename Sums>
+static TileScent decayed(const Sums &level, const Sums &carriers,
+                         const ScentField::Decay &decay) {
+  auto best = size_t(0);
+  auto most = int32_t(0);
+  auto n = int32_t(1);
+  for (size_t k = 1; k < level.size(); k++) {
+    auto better = level[k] > most;
+    best = better ? k : best;
+    most = better ? level[k] : most;
+    n = better ? carriers[k] : n;
+  }
+  auto p = most * decay.num / (n * decay.den);
+  if (best == 0 || p < decay.threshold) {
+    return {};
+  }
+  return {(uint8_t)best, (int16_t)p};
+}
+
+void ScentField::diffuse(const std::vector<TileScent> &from,
+                         const BitPlane &transparent,
+                         std::vector<TileScent> &to, const Decay &decay,
+                         ThreadPool *pool, int bandHeight) {
+  auto area = (size_t)(width * height);
+  active.clear();
+  if (tracked) {
+    for (auto i : frontLive) {
+      auto x = (int)i % width;
+      auto y = (int)i / width;
+      for (auto y2 = std::max(y - 1, 0); y2 <= std::min(y + 1, height - 1);
+           y2++) {
+        for (auto x2 = std::max(x - 1, 0); x2 <= std::min(x + 1, width - 1);
+             x2++) {
+          auto j = (size_t)(y2 * width + x2);
+          if (!inActive[j]) {
+            inActive[j] = 1;
+            active.push_back(j);
+          }
+        }
+      }
+    }
+    for (auto j : active) {
+      inActive[j] = 0;
+    }
+  }
+
+  if (!tracked || (float)active.size() > denseFraction * (float)area) {
+    diffuseDense(from, transparent, to, decay, pool, bandHeight);
+    findLive(from, backLive);
+    findLive(to, frontLive);
+    tracked = true;
+    return;
+  }
+
+  // `to` still holds the turn before last. Whatever of it isn't overwritten
+  // below is out of play, so it goes back to nothing.
+  for (auto i : backLive) {
+    to[i] = {};
+  }
+  backLive.clear();
+  for (auto i : active) {
+    auto &s = to[i];
+    s = diffuseTile(from, transparent, (int)i % width, (int)i / width, decay);
+    if (s.kind() != ScentType::none) {
+      backLive.push_back(i);
+    }
+  }
+  std::swap(frontLive, backLive);
+}
+
+TileScent ScentField::diffuseTile(const std::vector<TileScent> &from,
+                                  const BitPlane &transparent, int x, int y,
+                                  const Decay &decay) const {
+  if (!transparent.test(x, y)) {
+    return {};
+  }
+  auto levels = Sums{};
+  auto counts = Sums{};
+  auto &s = from[(size_t)(y * width + x)];
+  levels[s.type] = s.power;
+  counts[s.type]++;
+  for (auto &dir : directions) {
+    auto x2 = x + dir[0];
+    auto y2 = y + dir[1];
+    if (transparent.test(x2, y2)) {
+      auto &s = from[(size_t)(y2 * width + x2)];
+      levels[s.type] += s.power;
+      counts[s.type]++;
+    }
+  }
+  return decayed(levels, counts, decay);
+}
+
+void ScentField::findLive(const std::vector<TileScent> &buffer,
+                          std::vector<size_t> &live) {
+  live.clear();
+  for (size_t i = 0; i < buffer.size(); i++) {
+    if (buffer[i].kind() != ScentType::none) {
+      live.push_back(i);
+    }
+  }
+}
+
+void ScentField::diffuseDense(const std::vector<TileScent> &from,
+                              const BitPlane &transparent,
+                              std::vector<TileScent> &to, const Decay &decay,
+                              ThreadPool *pool, int bandHeight) {
+  auto bands = (size_t)((height + bandHeight - 1) / bandHeight);
+  auto inBands = [&](auto f) {
+    auto band = [&](size_t b) {
+      auto y0 = (int)b * bandHeight;
+      f(y0, std::min(y0 + bandHeight, height));
+    };
+    if (pool) {
+      pool->parallelFor(bands, band);
+    } else {
+      for (size_t b = 0; b < bands; b++) {
+        band(b);
+      }
+    }
+  };
+  // A row's stencil reads the rows either side of it, so every band has to
+  // be spread before any of them is gathered.
+  inBands([&](int y0, int y1) { spread(from, transparent, y0, y1); });
+  inBands([&](int y0, int y1) { gather(transparent, to, decay, y0, y1); });
+}
+
+void ScentField::spread(const std::vector<TileScent> &from,
+                        const BitPlane &transparent, int y0, int y1) {
+  for (auto y = y0; y < y1; y++) {
+    auto src = &from[(size_t)(y * width)];
+    auto open = transparent.row(y);
+    for (size_t k = 1; k < types; k++) {
+      auto p = &power[k][padded(0, y)];
+      auto c = &count[k][padded(0, y)];
+      for (auto x = 0; x < width; x++) {
+        auto on = (int32_t)((src[x].type == k) & (open[x / 64] >> (x % 64)) &
+                            1);
+        p[x] = on * src[x].power;
+        c[x] = on;
+      }
+    }
+  }
+}
+
+void ScentField::gather(const BitPlane &transparent,
+                        std::vector<TileScent> &to, const Decay &decay,
+                        int y0, int y1) {
+  for (size_t k = 1; k < types; k++) {
+    for (auto y = y0; y < y1; y++) {
+      auto i = (size_t)(y * width);
+      stencil(&power[k][padded(0, y)], stride, &level[k][i], width);
+      stencil(&count[k][padded(0, y)], stride, &carriers[k][i], width);
+    }
+  }
+
+  for (auto y = y0; y < y1; y++) {
+    auto open = transparent.row(y);
+    for (auto x = 0; x < width; x++) {
+      auto i = (size_t)(y * width + x);
+      auto levels = Sums{};
+      auto counts = Sums{};
+      for (size_t k = 1; k < types; k++) {
+        levels[k] = level[k][i];
+        counts[k] = carriers[k][i];
+      }
+      to[i] = ((open[x / 64] >> (x % 64)) & 1)
+                  ? decayed(levels, counts, decay)
+                  : TileScent{};
+    }
+  }
+}
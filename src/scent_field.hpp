@@ -0,0 +1,101 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "bitplane.hpp"
+#include "scent.hpp"
+#include "thread_pool.hpp"
+
+// Scratch space for diffusing scent a whole plane at a time. Each scent type
+// gets a plane of power and a plane of how many tiles carry it, with a tile of
+// padding all the way round, so the 3x3 stencil runs down contiguous rows
+// without checking bounds or walls.
+//
+// Most turns only a trail behind the player and a few corpses carry any
+// scent, so it also keeps track of which tiles do. While they and the tiles
+// around them are few, only those are worked out, a tile at a time.
+//
+// It is all integer arithmetic, so every way of working a turn gives the
+// same result.
+class ScentField {
+public:
+  // A tile keeps num / den of the average around it, rounded down, and
+  // anything under threshold (in TileScent units) is gone. Nine tiles' worth
+  // of power times num has to fit in an int32_t.
+  struct Decay {
+    int num;
+    int den;
+    int threshold;
+  };
+
+  ScentField(int width = 0, int height = 0);
+
+  // One turn of diffusion from `from` into `to`, both width * height. Each
+  // transparent tile takes the scent type with the most power on and around
+  // it, averaged over the tiles that carry it and decayed. Opaque tiles
+  // neither give nor get scent. The none type is taken to carry no power.
+  //
+  // `to` has to be the buffer that was `from` the turn before, as it is when
+  // the caller swaps the two after each turn. When the whole map is worked,
+  // the rows go in bands of bandHeight, spread across pool when there is one.
+  // Every tile is worked out on its own from `from`, so the result doesn't
+  // depend on which tiles were worked, the bands or the threads.
+  void diffuse(const std::vector<TileScent> &from,
+               const BitPlane &transparent, std::vector<TileScent> &to,
+               const Decay &decay, ThreadPool *pool = nullptr,
+               int bandHeight = 16);
+  // Tile i of the latest buffer may have scent on it now. Call it for every
+  // deposit made between turns.
+  inline void touch(size_t i) {
+    if (tracked) {
+      frontLive.push_back(i);
+    }
+  }
+
+  // Past this fraction of the map in play, the whole map is worked instead.
+  static constexpr auto denseFraction = 0.25f;
+
+private:
+  static constexpr auto types = static_cast<size_t>(ScentType::MAX);
+  using Sums = std::array<int32_t, types>;
+
+  void diffuseDense(const std::vector<TileScent> &from,
+                    const BitPlane &transparent, std::vector<TileScent> &to,
+                    const Decay &decay, ThreadPool *pool, int bandHeight);
+  // Rows y0 to y1 of from into the padded planes, and of the planes into to.
+  void spread(const std::vector<TileScent> &from, const BitPlane &transparent,
+              int y0, int y1);
+  void gather(const BitPlane &transparent, std::vector<TileScent> &to,
+              const Decay &decay, int y0, int y1);
+  // The same rule as diffuseDense, for the tile at x, y alone.
+  TileScent diffuseTile(const std::vector<TileScent> &from,
+                        const BitPlane &transparent, int x, int y,
+                        const Decay &decay) const;
+  // Every tile that carries scent in buffer.
+  void findLive(const std::vector<TileScent> &buffer,
+                std::vector<size_t> &live);
+  inline size_t padded(int x, int y) const {
+    return (size_t)((y + 1) * stride + x + 1);
+  }
+
+  int width;
+  int height;
+  int stride;
+  // By type, none left empty. power and count are padded, level and carriers
+  // (their 3x3 sums) are not.
+  std::array<std::vector<int32_t>, types> power;
+  std::array<std::vector<int32_t>, types> count;
+  std::array<std::vector<int32_t>, types> level;
+  std::array<std::vector<int32_t>, types> carriers;
+  // The tiles with scent on them in the latest buffer and in the one before,
+  // maybe with repeats. Unknown until the first dense turn.
+  bool tracked = false;
+  std::vector<size_t> frontLive;
+  std::vector<size_t> backLive;
+  // The tiles to work out this turn: the live ones and their neighbours.
+  std::vector<size_t> active;
+  std::vector<uint8_t> inActive;
+};
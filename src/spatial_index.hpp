@@ -0,0 +1,89 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include <flecs.h>
+
+// Buckets the children of a map by the tile they stand on, so "what is at
+// (x, y)" doesn't need a scan over every entity on the floor.
+class SpatialIndex {
+public:
+  SpatialIndex(int width = 0, int height = 0)
+      : width(width), height(height), tiles((size_t)(width * height)) {};
+
+  inline const std::vector<flecs::entity> &
+  at(std::array<int, 2> xy) const {
+    if (!inBounds(xy)) {
+      return empty;
+    }
+    return tiles[(size_t)(xy[1] * width + xy[0])];
+  }
+
+  // Adds e at xy, or moves it there if it is already indexed elsewhere.
+  void insert(flecs::entity e, std::array<int, 2> xy) {
+    if (!inBounds(xy)) {
+      erase(e);
+      return;
+    }
+    auto idx = xy[1] * width + xy[0];
+    auto it = location.find(e.id());
+    if (it != location.end()) {
+      if (it->second == idx) {
+        return;
+      }
+      remove(e, it->second);
+      it->second = idx;
+    } else {
+      location.emplace(e.id(), idx);
+    }
+    tiles[(size_t)idx].push_back(e);
+  }
+
+  inline std::optional<std::array<int, 2>> locate(flecs::entity e) const {
+    auto it = location.find(e.id());
+    if (it == location.end()) {
+      return std::nullopt;
+    }
+    return std::array{it->second % width, it->second / width};
+  }
+
+  void erase(flecs::entity e) {
+    auto it = location.find(e.id());
+    if (it != location.end()) {
+      remove(e, it->second);
+      location.erase(it);
+    }
+  }
+
+  void clear() {
+    for (auto &t : tiles) {
+      t.clear();
+    }
+    location.clear();
+  }
+
+private:
+  inline bool inBounds(std::array<int, 2> xy) const {
+    return 0 <= xy[0] && xy[0] < width && 0 <= xy[1] && xy[1] < height;
+  }
+
+  void remove(flecs::entity e, int idx) {
+    auto &t = tiles[(size_t)idx];
+    for (auto i = t.begin(); i != t.end(); i++) {
+      if (i->id() == e.id()) {
+        t.erase(i);
+        return;
+      }
+    }
+  }
+
+  int width;
+  int height;
+  std::vector<std::vector<flecs::entity>> tiles;
+  std::unordered_map<flecs::entity_t, int> location;
+  static inline const std::vector<flecs::entity> empty = {};
+};
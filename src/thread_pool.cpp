@@ -0,0 +1,87 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+size_t ThreadPool::defaultThreads() {
+#ifdef __EMSCRIPTEN__
+  return 0;
+#else
+  // The caller works too, so one fewer than there are cores.
+  auto cores = (size_t)std::thread::hardware_concurrency();
+  return std::max(cores, (size_t)1) - 1;
+#endif
+}
+
+ThreadPool::ThreadPool([[maybe_unused]] size_t threads) {
+#ifndef __EMSCRIPTEN__
+  for (size_t i = 0; i < threads; i++) {
+    workers.emplace_back([this]() { work(); });
+  }
+#endif
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    auto lock = std::unique_lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto &w : workers) {
+    w.join();
+  }
+}
+
+void ThreadPool::parallelFor(size_t n, const std::function<void(size_t)> &f) {
+  if (workers.empty() || n <= 1) {
+    for (size_t i = 0; i < n; i++) {
+      f(i);
+    }
+    return;
+  }
+
+  {
+    auto lock = std::unique_lock(mutex);
+    job = &f;
+    count = n;
+    next = 0;
+    busy = workers.size();
+    generation++;
+  }
+  wake.notify_all();
+  runJob();
+
+  auto lock = std::unique_lock(mutex);
+  done.wait(lock, [this]() { return busy == 0; });
+  job = nullptr;
+}
+
+ThreadPool &ThreadPool::shared() {
+  static auto pool = ThreadPool();
+  return pool;
+}
+
+void ThreadPool::work() {
+  auto seen = uint64_t(0);
+  while (true) {
+    auto lock = std::unique_lock(mutex);
+    wake.wait(lock, [&]() { return stopping || generation != seen; });
+    if (stopping) {
+      return;
+    }
+    seen = generation;
+    lock.unlock();
+
+    runJob();
+
+    lock.lock();
+    if (--busy == 0) {
+      done.notify_one();
+    }
+  }
+}
+
+void ThreadPool::runJob() {
+  for (auto i = next++; i < count; i = next++) {
+    (*job)(i);
+  }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads for spreading a loop over the cores. The web
+// build has no threads, so there everything runs on the caller.
+class ThreadPool {
+public:
+  explicit ThreadPool(size_t threads = defaultThreads());
+  ~ThreadPool();
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  // Calls f(i) for every i in [0, count), on the workers and the calling
+  // thread, and returns once all of them are done. f must not call back into
+  // the pool.
+  void parallelFor(size_t count, const std::function<void(size_t)> &f);
+
+  inline size_t size() const { return workers.size() + 1; }
+
+  static ThreadPool &shared();
+
+private:
+  static size_t defaultThreads();
+  void work();
+  void runJob();
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  const std::function<void(size_t)> *job = nullptr;
+  size_t count = 0;
+  std::atomic<size_t> next = 0;
+  size_t busy = 0;
+  uint64_t generation = 0;
+  bool stopping = false;
+};
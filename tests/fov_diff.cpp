@@ -0,0 +1,125 @@
+// Casts from random origins over random floors, with portals, and checks that
+// computeFov calls back with the same tiles, in the same order, as the
+// recursive float caster it replaced, and that the quadrants cast on a thread
+// pool come back in that order too.
+
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <optional>
+#include <random>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "fov.hpp"
+
+namespace {
+
+// A floor of transparent and opaque tiles, with portals both ways round.
+struct Floor {
+  int width;
+  int height;
+  std::vector<char> transparent;
+  std::map<std::array<int, 2>, std::array<int, 2>> portals;
+
+  inline bool inBounds(std::array<int, 2> xy) const {
+    return 0 <= xy[0] && xy[0] < width && 0 <= xy[1] && xy[1] < height;
+  }
+  inline bool isTransparent(std::array<int, 2> xy) const {
+    return transparent[(size_t)(xy[1] * width + xy[0])];
+  }
+  inline std::optional<std::array<int, 2>>
+  portalExit(std::array<int, 2> xy) const {
+    auto it = portals.find(xy);
+    if (it == portals.end()) {
+      return std::nullopt;
+    }
+    return it->second;
+  }
+};
+
+using Seen = std::vector<std::tuple<int, int, int>>;
+
+Floor randomFloor(std::mt19937 &rng) {
+  auto floor = Floor{20 + (int)(rng() % 60), 15 + (int)(rng() % 40), {}, {}};
+  auto tile = [&]() {
+    return std::array{(int)(rng() % (unsigned)floor.width),
+                      (int)(rng() % (unsigned)floor.height)};
+  };
+  floor.transparent.resize((size_t)(floor.width * floor.height));
+  auto walls = rng() % 60;
+  for (auto &t : floor.transparent) {
+    t = rng() % 100 >= walls;
+  }
+  // The reference caster can go round forever between portals that can see
+  // each other from next door, so they are kept apart.
+  for (auto i = rng() % 4; i > 0; i--) {
+    auto a = tile();
+    auto b = tile();
+    if (std::max(std::abs(a[0] - b[0]), std::abs(a[1] - b[1])) < 3 ||
+        floor.portals.count(a) || floor.portals.count(b)) {
+      continue;
+    }
+    floor.transparent[(size_t)(a[1] * floor.width + a[0])] = 1;
+    floor.transparent[(size_t)(b[1] * floor.width + b[0])] = 1;
+    floor.portals[a] = b;
+    floor.portals[b] = a;
+  }
+  return floor;
+}
+
+} // namespace
+
+int main() {
+  auto pool = ThreadPool(3);
+  auto rng = std::mt19937(1);
+  auto casts = 0;
+  auto failures = 0;
+  for (auto seed = 0; seed < 5000; seed++) {
+    auto floor = randomFloor(rng);
+    for (auto radius : {4, 8, 10}) {
+      auto origin = std::array{(int)(rng() % (unsigned)floor.width),
+                               (int)(rng() % (unsigned)floor.height)};
+      auto expected = Seen();
+      auto actual = Seen();
+      computeFovReference(floor, origin, radius, [&](auto xy, auto r2) {
+        expected.emplace_back(xy[0], xy[1], r2);
+      });
+      computeFov(floor, origin, radius, [&](auto xy, auto r2) {
+        actual.emplace_back(xy[0], xy[1], r2);
+      });
+      casts++;
+      if (actual != expected) {
+        failures++;
+        std::printf("floor %d: computeFov from (%d, %d) at radius %d differs\n",
+                    seed, origin[0], origin[1], radius);
+      }
+    }
+    // Against the integer cast there is no depth limit to keep to, so these go
+    // further out.
+    for (auto radius : {8, 20, 40}) {
+      auto origin = std::array{(int)(rng() % (unsigned)floor.width),
+                               (int)(rng() % (unsigned)floor.height)};
+      auto expected = Seen();
+      auto actual = Seen();
+      computeFov(floor, origin, radius, [&](auto xy, auto r2) {
+        expected.emplace_back(xy[0], xy[1], r2);
+      });
+      computeFov(
+          floor, origin, radius,
+          [&](auto xy, auto r2) { actual.emplace_back(xy[0], xy[1], r2); },
+          pool);
+      casts++;
+      if (actual != expected) {
+        failures++;
+        std::printf("floor %d: pooled computeFov from (%d, %d) at radius %d "
+                    "differs\n",
+                    seed, origin[0], origin[1], radius);
+      }
+    }
+  }
+  std::printf("%d casts, %d differ\n", casts, failures);
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}